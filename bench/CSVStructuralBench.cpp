@@ -0,0 +1,115 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Throughput of CSVStructuralIndexer alone, and of reading every row of a
+// mapped file with and without it, against stream-mode ReadRow and the
+// original ReadLine parser. The file has numeric and quoted text columns;
+// pass a path to use your own instead (ReadLine needs lines under 1024
+// bytes).
+//
+//   g++ -std=c++17 -O2 -march=native -Iinclude bench/CSVStructuralBench.cpp src/experimental/CSVFile.cpp
+//       src/experimental/CSVStructural.cpp src/experimental/CSVRowIndex.cpp -pthread
+
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <seLib/experimental/CSVFile.h>
+
+using namespace seLib::CSVFile;
+using namespace std;
+
+static const size_t RowCount = 3000000;
+
+static void Report(const char* name, size_t bytes, size_t cells, chrono::steady_clock::time_point start) {
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-28s %6.2f GB/s  (%zu cells)\n", name, bytes / seconds / 1e9, cells);
+}
+
+static size_t ReadRows(const string& path, bool mapped, bool structural) {
+    CSVReader reader;
+    if (mapped)
+        reader.OpenMapped(path);
+    else
+        reader.Open(path);
+    reader.UseStructuralIndex = structural;
+    size_t cells = 0;
+    while (reader.ReadRow())
+        cells += reader.cells.size();
+    return cells;
+}
+
+// ReadLine splits quoted cells at separators, so it counts more cells.
+static size_t ReadLines(const string& path) {
+    CSVReader reader;
+    reader.Open(path);
+    size_t cells = 0;
+    while (reader.ReadLine(0))
+        cells += reader.row.size();
+    return cells;
+}
+
+int main(int argc, char** argv) {
+    string path = "/tmp/CSVStructuralBench.csv";
+    if (argc > 1) {
+        path = argv[1];
+    } else {
+        CSVBufferedWriter writer(path);
+        for (size_t i = 0; i < RowCount; i++) {
+            writer.Write((uint64_t)i);
+            writer.Write(i * 0.37);
+            writer.Write((i % 7 == 0) ? "quoted, with separator" : "plain");
+            writer.Write((int32_t)(i % 1000) - 500);
+            writer.EndLine();
+        }
+        writer.Close();
+    }
+
+    CSVReader mapping;
+    mapping.OpenMapped(path);
+    size_t size = mapping.mapSize;
+
+    auto start = chrono::steady_clock::now();
+    CSVStructuralIndexer indexer;
+    vector<uint32_t> positions;
+    size_t structurals = 0;
+    for (size_t offset = 0; offset < size; offset += CSVStructuralCursor::Window) {
+        size_t len = min(size - offset, CSVStructuralCursor::Window);
+        structurals += indexer.Index(mapping.mapData + offset, len, positions);
+    }
+    Report("Index only", size, structurals, start);
+
+    start = chrono::steady_clock::now();
+    size_t cells = ReadRows(path, true, true);
+    Report("Mapped ReadRow, indexed", size, cells, start);
+
+    start = chrono::steady_clock::now();
+    cells = ReadRows(path, true, false);
+    Report("Mapped ReadRow, scalar", size, cells, start);
+
+    start = chrono::steady_clock::now();
+    cells = ReadRows(path, false, false);
+    Report("Stream ReadRow", size, cells, start);
+
+    start = chrono::steady_clock::now();
+    cells = ReadLines(path);
+    Report("Stream ReadLine", size, cells, start);
+
+    if (argc <= 1)
+        remove(path.c_str());
+    return 0;
+}
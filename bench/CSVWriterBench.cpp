@@ -0,0 +1,76 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Rows per second written by CSVBufferedWriter and by CSVFileWriter with
+// to_string, for rows of an index, a double, a float and a short text cell.
+//
+//   g++ -std=c++17 -O2 -Iinclude bench/CSVWriterBench.cpp src/experimental/CSVFile.cpp
+//       src/experimental/CSVStructural.cpp src/experimental/CSVRowIndex.cpp -pthread
+
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <seLib/experimental/CSVFile.h>
+
+using namespace seLib::CSVFile;
+using namespace std;
+
+static const size_t RowCount = 1000000;
+static const char* Labels[] = { "idle", "peak", "say \"hi\"", " padded " };
+
+static double Seconds(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    string path = (argc > 1) ? argv[1] : "/tmp/CSVWriterBench.csv";
+
+    auto start = chrono::steady_clock::now();
+    {
+        CSVBufferedWriter writer(path);
+        for (size_t i = 0; i < RowCount; i++) {
+            writer.Write((uint64_t)i);
+            writer.Write(i * 0.001);
+            writer.Write((float)i * 0.25f);
+            writer.Write(Labels[i % 4]);
+            writer.EndLine();
+        }
+        writer.Close();
+    }
+    double buffered = Seconds(start);
+
+    start = chrono::steady_clock::now();
+    {
+        CSVFileWriter writer(path);
+        vector<string> row(4);
+        for (size_t i = 0; i < RowCount; i++) {
+            row[0] = to_string(i);
+            row[1] = to_string(i * 0.001);
+            row[2] = to_string((float)i * 0.25f);
+            row[3] = Labels[i % 4];
+            writer.WriteLine(row);
+        }
+        writer.Close();
+    }
+    double legacy = Seconds(start);
+
+    remove(path.c_str());
+    printf("CSVBufferedWriter: %6.2f Mrows/s\n", RowCount / buffered / 1e6);
+    printf("CSVFileWriter:     %6.2f Mrows/s\n", RowCount / legacy / 1e6);
+    return 0;
+}
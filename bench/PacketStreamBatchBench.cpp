@@ -0,0 +1,128 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Packets per second delivered to two receivers by Notify per packet, and by
+// NotifyBatch to per-packet and to batch receivers, synchronously and through
+// an AsyncPacketStream, for batch sizes from 1 to 1024.
+//
+//   g++ -std=c++17 -O2 -Iinclude bench/PacketStreamBatchBench.cpp src/experimental/PacketStreamAsync.cpp -pthread
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include <seLib/experimental/PacketStreamAsync.h>
+
+using namespace seLib;
+using namespace std;
+
+static const size_t PacketSize = 64;
+static const size_t PacketCount = 20000000;
+static const size_t BatchSizes[] = { 1, 4, 16, 64, 256, 1024 };
+static const size_t MaxBatchSize = 1024;
+
+struct Sum {
+    atomic<uint64_t> Packets { 0 };
+    uint64_t Bytes = 0;
+};
+
+static void Packet(const PacketStreamDescriptor& /*descriptor*/, const uint8_t* packetdata, void* reference) {
+    Sum* sum = (Sum*)reference;
+    sum->Bytes += packetdata[0];
+    sum->Packets.store(sum->Packets.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static void Batch(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference) {
+    Sum* sum = (Sum*)reference;
+    for (size_t i = 0; i < packetcount; i++)
+        sum->Bytes += packetdata[i * descriptor.PacketSize];
+    sum->Packets.store(sum->Packets.load(memory_order_relaxed) + packetcount, memory_order_relaxed);
+}
+
+static void Report(const char* name, size_t packets, chrono::steady_clock::time_point start) {
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-44s %7.1f Mpackets/s\n", name, packets / seconds / 1e6);
+}
+
+template <typename Deliver_T>
+static void Run(const char* name, bool batchreceivers, size_t packets, Deliver_T deliver) {
+    Sum sums[2];
+    PacketStreamReceiver receivers[2];
+    for (int i = 0; i < 2; i++) {
+        receivers[i] = batchreceivers ? PacketStreamReceiver { nullptr, &sums[i], &Batch } :
+            PacketStreamReceiver { &Packet, &sums[i], nullptr };
+    }
+    PacketStreamDescriptor descriptor { 1, PacketSize, 2, receivers };
+
+    static uint8_t buffer[MaxBatchSize * PacketSize];
+    memset(buffer, 1, sizeof(buffer));
+    auto start = chrono::steady_clock::now();
+    deliver(descriptor, buffer);
+    // Asynchronous runs finish once the workers have delivered everything.
+    while (sums[0].Packets.load() < packets || sums[1].Packets.load() < packets)
+        this_thread::yield();
+    Report(name, packets, start);
+}
+
+int main() {
+    Run("Notify, per-packet receivers", false, PacketCount, [](const PacketStreamDescriptor& descriptor, const uint8_t* buffer) {
+        for (size_t i = 0; i < PacketCount; i++)
+            descriptor.Notify(buffer + (i % MaxBatchSize) * PacketSize);
+    });
+
+    char name[64];
+    for (size_t batch : BatchSizes) {
+        snprintf(name, sizeof(name), "NotifyBatch of %zu, per-packet receivers", batch);
+        Run(name, false, PacketCount, [batch](const PacketStreamDescriptor& descriptor, const uint8_t* buffer) {
+            for (size_t i = 0; i < PacketCount; i += batch)
+                descriptor.NotifyBatch(buffer, batch);
+        });
+    }
+    for (size_t batch : BatchSizes) {
+        snprintf(name, sizeof(name), "NotifyBatch of %zu, batch receivers", batch);
+        Run(name, true, PacketCount, [batch](const PacketStreamDescriptor& descriptor, const uint8_t* buffer) {
+            for (size_t i = 0; i < PacketCount; i += batch)
+                descriptor.NotifyBatch(buffer, batch);
+        });
+    }
+
+    // Asynchronous delivery blocks rather than drops, so every packet arrives.
+    // Each run is copied into one pool slot.
+    const size_t asynccount = PacketCount / 10;
+    PacketStreamWorkerPool pool(2);
+    AsyncPacketStreamOptions options;
+    options.Overflow = PacketStreamOverflow::Block;
+    Run("Async Notify, per-packet receivers", false, asynccount, [&](const PacketStreamDescriptor& descriptor, const uint8_t* buffer) {
+        AsyncPacketStream stream(descriptor, pool, options);
+        for (size_t i = 0; i < asynccount; i++)
+            stream.Notify(buffer);
+        while (stream.QueueDepth(0) > 0 || stream.QueueDepth(1) > 0)
+            this_thread::yield();
+    });
+    for (size_t batch : BatchSizes) {
+        options.SlotPackets = batch;
+        snprintf(name, sizeof(name), "Async NotifyBatch of %zu, batch receivers", batch);
+        Run(name, true, asynccount, [&](const PacketStreamDescriptor& descriptor, const uint8_t* buffer) {
+            AsyncPacketStream stream(descriptor, pool, options);
+            for (size_t i = 0; i < asynccount; i += batch)
+                stream.NotifyBatch(buffer, batch);
+            while (stream.QueueDepth(0) > 0 || stream.QueueDepth(1) > 0)
+                this_thread::yield();
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Loopback throughput and latency of the shared memory PacketStream
+// transport. For throughput a forked child reads every packet the parent
+// writes through an anonymous ring; for latency it echoes each packet back
+// through a second ring and the parent times the round trips.
+//
+//   g++ -std=c++17 -O2 -Iinclude bench/PacketStreamShmBench.cpp src/experimental/PacketStreamShm.cpp
+//       src/experimental/PacketStreamRouter.cpp -pthread
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <seLib/experimental/PacketStreamShm.h>
+
+using namespace seLib;
+using namespace std;
+
+static const size_t PacketCount = 4000000;
+static const size_t RoundTrips = 100000;
+
+struct Counter {
+    uint64_t Packets = 0;
+    uint64_t Errors = 0;
+};
+
+static void Count(const PacketStreamDescriptor& /*descriptor*/, const uint8_t* packetdata, void* reference) {
+    Counter* counter = (Counter*)reference;
+    uint64_t sequence;
+    memcpy(&sequence, packetdata, sizeof(sequence));
+    if (sequence != counter->Packets)
+        counter->Errors++;
+    counter->Packets++;
+}
+
+static int Consume(SharedMemoryRing& ring, size_t packetsize) {
+    Counter counter;
+    PacketStreamReceiver receivers[] = { { &Count, &counter, nullptr } };
+    PacketStreamDescriptor descriptor { 1, packetsize, 1, receivers };
+    PacketStreamRouter router;
+    router.Register(descriptor);
+
+    SharedMemoryPacketReader reader(ring, router);
+    while (counter.Packets < PacketCount) {
+        if (reader.Poll() == 0)
+            reader.Wait(100);
+    }
+    return (counter.Errors == 0 && reader.LengthErrors == 0 && reader.UnknownTypes == 0) ? 0 : 1;
+}
+
+static void Run(size_t packetsize, bool batched) {
+    SharedMemoryRing ring;
+    ring.CreateAnonymous(4 << 20);
+
+    auto start = chrono::steady_clock::now();
+    pid_t child = fork();
+    if (child == 0)
+        _exit(Consume(ring, packetsize));
+
+    SharedMemoryPacketWriter writer(ring);
+    PacketStreamDescriptor descriptor { 1, packetsize, 0, nullptr };
+    const size_t batch = 64;
+    uint8_t packets[batch * 1024] = {};
+    for (uint64_t sequence = 0; sequence < PacketCount; ) {
+        if (batched) {
+            for (size_t i = 0; i < batch; i++, sequence++)
+                memcpy(packets + i * packetsize, &sequence, sizeof(sequence));
+            SharedMemoryPacketWriter::BatchCallback(descriptor, packets, batch, &writer);
+        } else {
+            memcpy(packets, &sequence, sizeof(sequence));
+            writer.Write(1, packets, packetsize);
+            sequence++;
+        }
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    printf("%5zu byte packets, %s: %6.2f Mpackets/s, %7.1f MB/s%s\n", packetsize, batched ? "batches of 64" : "one at a time",
+        PacketCount / seconds / 1e6, PacketCount * packetsize / seconds / 1e6, ok ? "" : "  CONSUMER ERROR");
+}
+
+static void Echo(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference) {
+    ((SharedMemoryPacketWriter*)reference)->Write(descriptor.PacketType, packetdata, descriptor.PacketSize);
+}
+
+static int EchoAll(SharedMemoryRing& forward, SharedMemoryRing& back, size_t packetsize) {
+    SharedMemoryPacketWriter writer(back);
+    PacketStreamReceiver receivers[] = { { &Echo, &writer, nullptr } };
+    PacketStreamDescriptor descriptor { 1, packetsize, 1, receivers };
+    PacketStreamRouter router;
+    router.Register(descriptor);
+
+    SharedMemoryPacketReader reader(forward, router);
+    while (reader.Packets < RoundTrips) {
+        if (reader.Poll() == 0)
+            reader.Wait(100);
+    }
+    return 0;
+}
+
+// Round trip time of one packet at a time, with the reader sleeping in
+// Wait whenever its ring is empty, as SharedMemoryPacketReader::Run does.
+static void RunLatency(size_t packetsize) {
+    SharedMemoryRing forward;
+    SharedMemoryRing back;
+    forward.CreateAnonymous(1 << 20);
+    back.CreateAnonymous(1 << 20);
+
+    pid_t child = fork();
+    if (child == 0)
+        _exit(EchoAll(forward, back, packetsize));
+
+    Counter counter;
+    PacketStreamReceiver receivers[] = { { &Count, &counter, nullptr } };
+    PacketStreamDescriptor descriptor { 1, packetsize, 1, receivers };
+    PacketStreamRouter router;
+    router.Register(descriptor);
+    SharedMemoryPacketReader reader(back, router);
+    SharedMemoryPacketWriter writer(forward);
+
+    vector<double> times(RoundTrips);
+    uint8_t packet[1024] = {};
+    for (uint64_t sequence = 0; sequence < RoundTrips; sequence++) {
+        memcpy(packet, &sequence, sizeof(sequence));
+        auto start = chrono::steady_clock::now();
+        writer.Write(1, packet, packetsize);
+        while (counter.Packets <= sequence) {
+            if (reader.Poll() == 0)
+                reader.Wait(100);
+        }
+        times[sequence] = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && counter.Errors == 0;
+    sort(times.begin(), times.end());
+    printf("%5zu byte packets, round trip: median %6.2f us, 99%% %7.2f us, 99.9%% %7.2f us, max %8.1f us%s\n", packetsize,
+        times[RoundTrips / 2], times[RoundTrips * 99 / 100], times[RoundTrips * 999 / 1000], times.back(), ok ? "" : "  ECHO ERROR");
+}
+
+int main() {
+    for (size_t packetsize : { 16, 64, 256, 1024 }) {
+        Run(packetsize, false);
+        Run(packetsize, true);
+    }
+    for (size_t packetsize : { 16, 1024 })
+        RunLatency(packetsize);
+    return 0;
+}
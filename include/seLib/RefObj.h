@@ -16,6 +16,7 @@
 */
 
 #include <stdint.h>
+#include <atomic>
 #include <exception>
 
 #pragma warning(disable: 4521)
@@ -26,12 +27,13 @@ namespace seLib {
 
 //============================================================================
 // A reference counter for an existing memory buffer. Buffer allocation and
-// de-allocation must be handled separately.
+// de-allocation must be handled separately. The counter is atomic so views of
+// the same buffer may be held and released from different threads.
 class RefBuffer {
 protected:
 	uint8_t* const _Data;
 	size_t const _DataSize = 0;
-	uint32_t _RefCount = 0;
+	atomic<uint32_t> _RefCount { 0 };
 
 public:
 	RefBuffer(uint8_t* data, size_t datasize) : _Data(data), _DataSize(datasize) { }
@@ -44,21 +46,21 @@ public:
 	}
 
 	void Subscribe() {
-		if (_RefCount == UINT32_MAX)
+		if (_RefCount.load(memory_order_relaxed) == UINT32_MAX)
 			throw exception();
-		_RefCount++;
+		_RefCount.fetch_add(1, memory_order_relaxed);
 	}
 
 	void Release() {
-		if (_RefCount == UINT32_MAX || _RefCount == 0)
+		uint32_t count = _RefCount.fetch_sub(1, memory_order_acq_rel);
+		if (count == UINT32_MAX || count == 0)
 			throw exception();
-		_RefCount--;
-		if (_RefCount == 0)
-			delete this;
+		if (count == 1)
+			Free();
 	}
 
 	inline int RefCount() {
-		return _RefCount;
+		return _RefCount.load(memory_order_relaxed);
 	}
 
 	inline uint8_t* operator*() {
@@ -80,6 +82,13 @@ public:
 			source++;
 		}
 	}
+
+protected:
+	// Called when the last reference is released. Buffers owned by a pool
+	// override this to recycle themselves instead of being deleted.
+	virtual void Free() {
+		delete this;
+	}
 };
 
 //============================================================================
@@ -353,7 +362,7 @@ protected:
 		//if (offset + len > _buffer->size())
 			//throw exception();
 		if (_buffer != nullptr) {
-			_start = (Data_T*)(**_buffer + offset);
+			this->_start = (Data_T*)(**_buffer + offset);
 			_buffer->Subscribe();
 		}
 	}
@@ -385,7 +394,7 @@ public:
 		_buffer(new TypedManagedRefBuffer<Data_T>(std::forward<_Valty>(_Val)...)),
 		TypedBufferView<Data_T>(nullptr)
 	{
-		_start = (Data_T*)_buffer->operator*();
+		this->_start = (Data_T*)_buffer->operator*();
 		_buffer->Subscribe();
 	}//*/
 
@@ -420,7 +429,7 @@ public:
 
 	template<typename Cast_T>
 	TypedRefBufferView<Cast_T> cast() {
-		Cast_T* cast_ptr = (Cast_T*)_start;
+		Cast_T* cast_ptr = (Cast_T*)this->_start;
 		size_t offset = (uint8_t*)cast_ptr - **_buffer;
 		return TypedRefBufferView<Cast_T>::from_RefBuffer(_buffer, offset);
 	}
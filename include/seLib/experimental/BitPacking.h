@@ -0,0 +1,74 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <seLib/FixedPoint.h>
+
+namespace seLib {
+namespace Serializable {
+
+using namespace std;
+
+// Samples of any width from 1 to 32 bits, packed back to back with no
+// padding: sample i occupies bits i * bits to (i + 1) * bits - 1 of the
+// buffer, least significant bit first, as most 12- and 24-bit converters
+// produce them. Signed types are stored in two's complement and sign
+// extended when unpacked; only the low bits of each sample are stored, so
+// samples must fit. Widths above 16 need a 32-bit type.
+//
+// Unpacking up to 25 bits uses AVX2 (four samples per byte shuffle and
+// variable shift); packing 12- and 24-bit samples uses SSSE3 shuffles.
+// Everything else falls back to a 64-bit bit accumulator.
+
+// Bytes taken by count packed samples.
+inline size_t PackedSampleSize(unsigned int bits, size_t count) {
+    return (count * bits + 7) / 8;
+}
+
+void PackSamples(const int16_t* in, size_t count, unsigned int bits, uint8_t* out);
+void PackSamples(const uint16_t* in, size_t count, unsigned int bits, uint8_t* out);
+void PackSamples(const int32_t* in, size_t count, unsigned int bits, uint8_t* out);
+void PackSamples(const uint32_t* in, size_t count, unsigned int bits, uint8_t* out);
+
+// Store round(in[i] / scale), clamped to the signed range of bits.
+void PackSamples(const float* in, size_t count, unsigned int bits, float scale, uint8_t* out);
+
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, int16_t* out);
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, uint16_t* out);
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, int32_t* out);
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, uint32_t* out);
+
+// Signed samples multiplied by scale.
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, float scale, float* out);
+
+// FixedPoint arrays are packed as their raw storage values.
+template <int magnitude, bool safe_checks, typename Storage_T, typename Math_T>
+inline void PackSamples(const FixedPoint<magnitude, safe_checks, Storage_T, Math_T>* in, size_t count, unsigned int bits, uint8_t* out) {
+    static_assert(sizeof(FixedPoint<magnitude, safe_checks, Storage_T, Math_T>) == sizeof(Storage_T), "FixedPoint must be its storage");
+    PackSamples((const Storage_T*)in, count, bits, out);
+}
+
+template <int magnitude, bool safe_checks, typename Storage_T, typename Math_T>
+inline void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, FixedPoint<magnitude, safe_checks, Storage_T, Math_T>* out) {
+    static_assert(sizeof(FixedPoint<magnitude, safe_checks, Storage_T, Math_T>) == sizeof(Storage_T), "FixedPoint must be its storage");
+    UnpackSamples(in, count, bits, (Storage_T*)out);
+}
+
+}
+}
@@ -0,0 +1,127 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <exception>
+
+namespace seLib {
+
+using namespace std;
+
+// Fixed capacity lock-free FIFO queue, safe for any number of producer and
+// consumer threads (bounded MPMC ring with per-cell sequence numbers). Push and
+// pop are constant-time and never allocate. The capacity is rounded up to a
+// power of two. Intended for small trivially copyable values such as pointers.
+template <typename T>
+class BoundedQueue {
+protected:
+    struct Cell {
+        atomic<size_t> Sequence;
+        T Data;
+    };
+
+    Cell* const _Cells;
+    size_t const _Mask;
+    alignas(64) atomic<size_t> _EnqueuePos { 0 };
+    alignas(64) atomic<size_t> _DequeuePos { 0 };
+
+    static size_t RoundCapacity(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+public:
+    BoundedQueue(size_t capacity) :
+        _Cells(new Cell[RoundCapacity(capacity)]),
+        _Mask(RoundCapacity(capacity) - 1)
+    {
+        for (size_t i = 0; i <= _Mask; i++)
+            _Cells[i].Sequence.store(i, memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue(BoundedQueue&&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(BoundedQueue&&) = delete;
+
+    ~BoundedQueue() {
+        delete[] _Cells;
+    }
+
+    // Append a value. Returns false if the queue is full.
+    bool TryPush(const T& value) {
+        size_t pos = _EnqueuePos.load(memory_order_relaxed);
+        for (;;) {
+            Cell& cell = _Cells[pos & _Mask];
+            size_t seq = cell.Sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (_EnqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    cell.Data = value;
+                    cell.Sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _EnqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Remove the oldest value. Returns false if the queue is empty.
+    bool TryPop(T& value) {
+        size_t pos = _DequeuePos.load(memory_order_relaxed);
+        for (;;) {
+            Cell& cell = _Cells[pos & _Mask];
+            size_t seq = cell.Sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (_DequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    value = cell.Data;
+                    cell.Sequence.store(pos + _Mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _DequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate number of queued values; exact only when the queue is idle.
+    size_t size() const {
+        size_t enq = _EnqueuePos.load(memory_order_relaxed);
+        size_t deq = _DequeuePos.load(memory_order_relaxed);
+        return (enq > deq) ? (enq - deq) : 0;
+    }
+
+    inline bool empty() const {
+        return size() == 0;
+    }
+
+    inline size_t capacity() const {
+        return _Mask + 1;
+    }
+};
+
+}
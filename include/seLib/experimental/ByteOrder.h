@@ -0,0 +1,147 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace seLib {
+namespace Serializable {
+
+using namespace std;
+
+enum class ByteOrder {
+    Little,
+    Big,
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    Native = Big,
+#else
+    Native = Little,
+#endif
+};
+
+template <size_t Size> struct UnsignedOfSize;
+template <> struct UnsignedOfSize<1> { typedef uint8_t type; };
+template <> struct UnsignedOfSize<2> { typedef uint16_t type; };
+template <> struct UnsignedOfSize<4> { typedef uint32_t type; };
+template <> struct UnsignedOfSize<8> { typedef uint64_t type; };
+
+inline uint8_t ByteSwap(uint8_t value) { return value; }
+inline uint16_t ByteSwap(uint16_t value) { return __builtin_bswap16(value); }
+inline uint32_t ByteSwap(uint32_t value) { return __builtin_bswap32(value); }
+inline uint64_t ByteSwap(uint64_t value) { return __builtin_bswap64(value); }
+
+// Reverse the bytes of each of count Size-byte values from src into dst.
+// dst may be src; the buffers must not otherwise overlap. Whole vectors are
+// shuffled with AVX2 or SSSE3 when available, the rest one value at a time.
+template <size_t Size>
+inline void ByteSwapArray(void* dst, const void* src, size_t count) {
+    typedef typename UnsignedOfSize<Size>::type Unsigned_t;
+    uint8_t* out = (uint8_t*)dst;
+    const uint8_t* in = (const uint8_t*)src;
+    size_t bytes = count * Size;
+    size_t i = 0;
+
+    if (Size == 1) {
+        if (dst != src)
+            memcpy(dst, src, bytes);
+        return;
+    }
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+    // Byte j of each 16 comes from the mirrored position in its value.
+    uint8_t order[16];
+    for (int j = 0; j < 16; j++)
+        order[j] = (uint8_t)((j / Size) * Size + (Size - 1 - j % Size));
+    const __m128i shuffle = _mm_loadu_si128((const __m128i*)order);
+#if defined(__AVX2__)
+    const __m256i shuffle2 = _mm256_broadcastsi128_si256(shuffle);
+    for (; i + 64 <= bytes; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(in + i + 32));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(a, shuffle2));
+        _mm256_storeu_si256((__m256i*)(out + i + 32), _mm256_shuffle_epi8(b, shuffle2));
+    }
+#endif
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(a, shuffle));
+    }
+#endif
+
+    for (; i < bytes; i += Size) {
+        Unsigned_t value;
+        memcpy(&value, in + i, Size);
+        value = ByteSwap(value);
+        memcpy(out + i, &value, Size);
+    }
+}
+
+// Convert count values between the given byte order and the host's. When
+// they match this is a copy, or nothing at all in place.
+template <ByteOrder Order, typename T>
+inline void ConvertArray(void* dst, const void* src, size_t count) {
+    static_assert(is_arithmetic<T>::value, "byte order conversion needs an arithmetic type");
+    if (Order == ByteOrder::Native) {
+        if (dst != src)
+            memcpy(dst, src, count * sizeof(T));
+    } else {
+        ByteSwapArray<sizeof(T)>(dst, src, count);
+    }
+}
+
+// Read count values stored in big or little endian order at in.
+template <typename T>
+inline void FromBigEndian(T* out, const void* in, size_t count) {
+    ConvertArray<ByteOrder::Big, T>(out, in, count);
+}
+
+template <typename T>
+inline void FromLittleEndian(T* out, const void* in, size_t count) {
+    ConvertArray<ByteOrder::Little, T>(out, in, count);
+}
+
+// Store count values to out in big or little endian order.
+template <typename T>
+inline void ToBigEndian(void* out, const T* in, size_t count) {
+    ConvertArray<ByteOrder::Big, T>(out, in, count);
+}
+
+template <typename T>
+inline void ToLittleEndian(void* out, const T* in, size_t count) {
+    ConvertArray<ByteOrder::Little, T>(out, in, count);
+}
+
+// In place: reorder a received array for the host, or a host array for
+// sending. Conversion is its own inverse, so one function serves both.
+template <typename T>
+inline void SwapBigEndian(T* data, size_t count) {
+    ConvertArray<ByteOrder::Big, T>(data, data, count);
+}
+
+template <typename T>
+inline void SwapLittleEndian(T* data, size_t count) {
+    ConvertArray<ByteOrder::Little, T>(data, data, count);
+}
+
+}
+}
@@ -0,0 +1,114 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <seLib/experimental/CSVFile.h>
+#include <seLib/experimental/CSVSidecar.h>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+enum class CSVColumnType {
+  Float,
+  Double,
+  Int32,
+  Int64,
+};
+
+struct CSVColumnError {
+  enum Kind_t {
+    Missing,    // the row has no such cell, or it is empty
+    Invalid,    // the cell is not a number of the column's type
+    OutOfRange, // the number does not fit the column's type
+  };
+
+  size_t Row;          // data row, not counting the header
+  unsigned int Column;
+  Kind_t Kind;
+};
+
+// Parses selected columns of a CSV file straight into typed vectors with
+// from_chars. Cells of columns that are not selected are skipped without
+// being trimmed or copied; on a mapped CSVReader only their structural
+// positions are visited. Every selected vector gets one value per data row:
+// a cell that cannot be parsed gives NaN (or 0 for integers) and an entry in
+// Errors.
+//
+// A mapped reader that has not read any rows is served from its sidecar
+// (see CSVSidecar) instead, if that is current and was written with the same
+// separator, quoting and header settings. The values and errors are those a
+// parse would give; columns the sidecar cannot serve exactly (text, integer
+// targets of Double columns, float targets whose narrowing differs) make the
+// whole read parse instead.
+class CSVColumnExtractor {
+protected:
+  struct Target {
+    unsigned int Column;
+    string Name;
+    CSVColumnType Type;
+    void* Out;
+    size_t LastRow;
+    int Next;  // next target selecting the same column, or -1
+  };
+
+  vector<Target> _Targets;
+  vector<int> _ByColumn;
+
+public:
+  // The first row holds column names, which Select may refer to.
+  bool HeaderRow = false;
+  vector<CSVColumnError> Errors;
+  size_t Rows = 0;
+  // Use a current sidecar of the reader's file instead of parsing it.
+  bool UseSidecar = true;
+  // Write the sidecar first if there is no current one.
+  bool CreateSidecar = false;
+
+  void Select(unsigned int column, vector<float>& out) { Add(column, "", CSVColumnType::Float, &out); }
+  void Select(unsigned int column, vector<double>& out) { Add(column, "", CSVColumnType::Double, &out); }
+  void Select(unsigned int column, vector<int32_t>& out) { Add(column, "", CSVColumnType::Int32, &out); }
+  void Select(unsigned int column, vector<int64_t>& out) { Add(column, "", CSVColumnType::Int64, &out); }
+
+  // Select by header name; requires HeaderRow.
+  void Select(const string& name, vector<float>& out) { Add(0, name, CSVColumnType::Float, &out); }
+  void Select(const string& name, vector<double>& out) { Add(0, name, CSVColumnType::Double, &out); }
+  void Select(const string& name, vector<int32_t>& out) { Add(0, name, CSVColumnType::Int32, &out); }
+  void Select(const string& name, vector<int64_t>& out) { Add(0, name, CSVColumnType::Int64, &out); }
+
+  // Read all remaining rows of reader and return the number of data rows.
+  // Throws if a selected name is not in the header, or if names are selected
+  // without HeaderRow.
+  size_t Read(CSVReader& reader);
+
+protected:
+  void Add(unsigned int column, const string& name, CSVColumnType type, void* out);
+  void Resolve(const vector<string_view>& header);
+  void Store(Target& target, string_view cell, size_t row);
+  void StoreColumn(unsigned int column, string_view cell, size_t row);
+  void FinishRow(size_t row);
+  bool ReadSidecar(CSVReader& reader);
+  void Fill(Target& target, const CSVSidecar& sidecar, size_t first);
+};
+
+}
+}
@@ -0,0 +1,89 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <seLib/experimental/DataSet.h>
+#include <seLib/experimental/CSVFile.h>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+// Streams DataSet objects to a CSVBufferedWriter, either one column per set
+// or one row per set. Sets with an arithmetic DataSetType are read through
+// RawData once per Export and their values formatted straight into the
+// writer's buffer; any other DataSet falls back to to_string per element.
+// The sets are not owned and must outlive the exporter's use of them.
+class CSVDataSetExporter {
+public:
+  enum Layout_t {
+    Columns,  // header row of set names, then element i of every set per row
+    Rows,     // one row per set: its name, then its elements
+  };
+
+protected:
+  struct Column {
+    DataSet* Set;
+    DataSetType Type;
+    const void* Data;
+    size_t Size;
+  };
+
+  CSVBufferedWriter& _Writer;
+  vector<DataSet*> _Sets;
+  vector<Column> _Columns;
+  bool _HeaderWritten = false;
+
+public:
+  Layout_t Layout = Columns;
+  // Columns layout: write the set names before the first row.
+  bool Header = true;
+  // Columns layout: start every row with its element index.
+  bool IndexColumn = false;
+
+  CSVDataSetExporter(CSVBufferedWriter& writer, Layout_t layout = Columns) :
+    _Writer(writer), Layout(layout)
+  { }
+
+  CSVDataSetExporter(const CSVDataSetExporter&) = delete;
+  CSVDataSetExporter& operator=(const CSVDataSetExporter&) = delete;
+
+  void Add(DataSet& set) {
+    _Sets.push_back(&set);
+  }
+
+  void Clear() {
+    _Sets.clear();
+  }
+
+  // Write the current contents of every set. In the Columns layout the header
+  // is written once, so calling Export after each update of a set of scalar
+  // results appends one row per call. Returns the number of rows written.
+  size_t Export();
+
+protected:
+  void Resolve();
+  void WriteElement(const Column& column, size_t index);
+  string ColumnName(size_t index);
+};
+
+}
+}
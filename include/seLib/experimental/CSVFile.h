@@ -23,12 +23,67 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
+
+#include <seLib/experimental/CSVStructural.h>
 
 namespace seLib {
 namespace CSVFile {
 
 using namespace std;
 
+// Rows parsed by CSVReader::ReadAll. Cells are stored row after row; row i
+// has the cells from rowStarts[i] up to rowStarts[i + 1].
+class CSVTable {
+public:
+  vector<string_view> cells;
+  vector<size_t> rowStarts;
+
+  inline size_t RowCount() const {
+    return rowStarts.empty() ? 0 : rowStarts.size() - 1;
+  }
+
+  inline size_t CellCount(size_t row) const {
+    return rowStarts[row + 1] - rowStarts[row];
+  }
+
+  inline const string_view* Row(size_t row) const {
+    return cells.data() + rowStarts[row];
+  }
+
+  // Cell of a row, or an empty view if the row is shorter.
+  inline string_view Cell(size_t row, size_t column) const {
+    return (column < CellCount(row)) ? Row(row)[column] : string_view();
+  }
+
+  void clear() {
+    cells.clear();
+    rowStarts.clear();
+  }
+};
+
+// ReadLine parses lines of up to 1024 bytes from a stream into null
+// terminated cells in `row`. ReadRow has no line length limit and returns
+// cells in `cells` as views into the current row without copying:
+//  - In mapped mode (OpenMapped) the views point into the memory mapped file
+//    and stay valid until Close. In read-ahead mode (OpenReadAhead) they
+//    point into the current read buffer, or into lineBuffer for a row that
+//    straddles two buffers. Otherwise each line is read into lineBuffer. In
+//    both cases the views are valid until the next ReadRow.
+//  - Cells are split at Separator. Leading and trailing spaces (and tabs,
+//    unless Separator is a tab) are trimmed, and empty cells are kept, so a
+//    cell's index is its column.
+//  - With ParseQuotes, a cell may be enclosed in double quotes, which are
+//    removed. Separators and line breaks inside quotes are part of the cell;
+//    anything between the closing quote and the next separator is ignored.
+//  - A backslash escapes the next character, which then never ends a cell,
+//    quote or row. Both characters are kept in the cell.
+// In mapped mode, rows and cells are found with CSVStructuralIndexer a window
+// at a time unless UseStructuralIndex is cleared, in which case the scalar
+// FindRowEnd and ParseRow are used.
+class CSVReadAhead;
+class CSVRowIndex;
+
 class CSVReader {
 public:
   string FileName = "";
@@ -37,6 +92,18 @@ public:
   char* readBuffer;
   istream* reader = nullptr;
   vector<const char*> row;
+  vector<string_view> cells;
+  string lineBuffer;
+  const char* mapData = nullptr;
+  size_t mapSize = 0;
+  size_t mapPosition = 0;
+  bool mapped = false;
+  bool UseStructuralIndex = true;
+  CSVStructuralCursor cursor;
+  bool cursorReady = false;
+  CSVReadAhead* readAhead = nullptr;
+  // Index of the mapped file used by Seek, ReadRange and ReadAll; not owned.
+  const CSVRowIndex* rowIndex = nullptr;
 
   CSVReader();
 
@@ -46,11 +113,92 @@ public:
 
   void Open(istream& source);
 
+  // Map the whole file into memory for ReadRow.
+  void OpenMapped(const string& fileName);
+
+  // Read the file with pread on a background thread into bufferCount
+  // buffers of bufferSize bytes, so the next buffer is read while ReadRow
+  // parses the current one.
+  void OpenReadAhead(const string& fileName, size_t bufferSize = 4 << 20, unsigned int bufferCount = 2);
+
   void Close();
 
-  inline bool eof() { return reader == nullptr || reader->eof(); }
+  inline bool eof() {
+    if (mapped)
+      return mapPosition >= mapSize;
+    if (readAhead != nullptr)
+      return ReadAheadAtEnd();
+    return reader == nullptr || reader->eof();
+  }
 
   bool ReadLine(unsigned int maxCellCount);
+
+  // A cell without its escaping backslashes: each backslash is dropped and
+  // the character after it kept as is.
+  static string Unescape(string_view cell);
+
+  // Append the unescaped cell to out, so a reused string does not allocate.
+  static void Unescape(string_view cell, string& out);
+
+  // Read the next row into `cells`, keeping at most maxCellCount cells if it
+  // is not zero. Returns false at the end of the input.
+  bool ReadRow(unsigned int maxCellCount = 0);
+
+  // Parse all remaining rows of a mapped file into table, splitting the file
+  // into chunks parsed on threadCount threads (all cores if zero). The
+  // table's cells point into the mapping and are valid until Close.
+  void ReadAll(CSVTable& table, unsigned int threadCount = 0, unsigned int maxCellCount = 0);
+
+  // Position a mapped reader so the next ReadRow returns row (counting from
+  // the first row of the file, header and empty lines included). Jumps to
+  // the nearest row in rowIndex and skips the rest. Returns false, at the
+  // end of the file, if there are not that many rows.
+  bool Seek(uint64_t row);
+
+  // Read count rows from row first of a mapped file into table. Returns the
+  // number of rows read. The table's cells are valid until Close.
+  size_t ReadRange(uint64_t first, size_t count, CSVTable& table, unsigned int maxCellCount = 0);
+
+  // Position a mapped reader at the first row from the current one whose
+  // cell in column is a number at least value, assuming the column is
+  // sorted (rows where it is not a number, such as a header, count as
+  // smaller). Binary searches the rows in rowIndex and scans at most one
+  // interval. Returns false, at the end of the file, if there is none.
+  bool SeekValue(unsigned int column, double value);
+
+  // Split one row (without its line break) into `cells`.
+  void ParseRow(const char* begin, const char* end, unsigned int maxCellCount = 0);
+
+  // Quote and escape state at the end of a partial row.
+  struct RowState {
+    bool InQuote = false;
+    bool Escaped = false;  // the next character is escaped
+    bool Open() const { return InQuote || Escaped; }
+  };
+
+  // End of the row starting at begin: its terminating newline, or end if
+  // there is none. If state is given, the scan starts in it, and when end is
+  // reached it is updated so the row can be continued with the next piece.
+  const char* FindRowEnd(const char* begin, const char* end, RowState* state = nullptr) const;
+
+  // Trim and unquote one cell.
+  string_view Cell(const char* start, const char* stop) const;
+
+  inline bool IsSpace(char c) const {
+    return c == ' ' || (c == '\t' && Separator != '\t');
+  }
+
+  // Append the cells of the mapped row starting at position, whose
+  // structurals come next from rowCursor, to out. Returns the start of the
+  // next row.
+  size_t ParseIndexedRow(CSVStructuralCursor& rowCursor, size_t position, unsigned int maxCellCount, vector<string_view>& out) const;
+
+protected:
+  bool ReadIndexedRow(unsigned int maxCellCount);
+  bool ReadAheadRow(unsigned int maxCellCount);
+  bool ReadAheadAtEnd();
+  void SkipRows(uint64_t count);
+  bool IndexMatches() const;
 };
 
 class CSVFileWriter {
@@ -68,7 +216,85 @@ public:
 
   void Close();
 
-  void WriteLine(vector<string> data);
+  void WriteLine(const vector<string>& data);
+};
+
+// Buffered CSV writer. Cells are formatted straight into a large buffer
+// (numbers with to_chars, shortest round-trip for floating point) which is
+// written to the file with write(2) when full. A text cell is quoted only if
+// it contains a separator, quote, backslash or line break, or starts or ends
+// with whitespace; quotes and backslashes inside it are escaped with a
+// backslash. CSVReader keeps escapes in the cell, so a cell written as
+// say "hi" reads back as say \"hi\"; CSVReader::Unescape of any cell read
+// back gives the text that was written.
+class CSVBufferedWriter {
+protected:
+  int _Fd = -1;
+  bool _Owner = false;
+  vector<char> _Buffer;
+  size_t _Used = 0;
+  bool _LineStart = true;
+
+public:
+  string FileName = "";
+  char Separator = ',';
+
+  CSVBufferedWriter(const string& fileName, size_t bufferSize = 1 << 20);
+
+  // Write to an open file descriptor, which is not closed.
+  CSVBufferedWriter(int fd, size_t bufferSize = 1 << 20);
+
+  CSVBufferedWriter(const CSVBufferedWriter&) = delete;
+  CSVBufferedWriter& operator=(const CSVBufferedWriter&) = delete;
+
+  ~CSVBufferedWriter();
+
+  void Write(float value);
+  void Write(double value);
+  void Write(int32_t value);
+  void Write(int64_t value);
+  void Write(uint32_t value);
+  void Write(uint64_t value);
+  void Write(string_view value);
+
+  inline void Write(const char* value) {
+    Write(string_view(value));
+  }
+
+  // Write an empty cell.
+  void Skip();
+
+  void EndLine();
+
+  void WriteLine(const vector<string>& data);
+
+  void Flush();
+
+  // Flush and close the file. The file is closed even if the flush throws.
+  // The destructor does this too but ignores errors; call Close to see them.
+  void Close();
+
+  // True if a text cell must be quoted to read back as one cell with the
+  // same text after CSVReader::Unescape.
+  bool NeedsQuotes(string_view value) const;
+
+protected:
+  inline char* Reserve(size_t len) {
+    if (_Used + len > _Buffer.size())
+      FlushBuffer(len);
+    return _Buffer.data() + _Used;
+  }
+
+  inline void BeginCell() {
+    if (!_LineStart)
+      *Reserve(1) = Separator, _Used++;
+    _LineStart = false;
+  }
+
+  template <typename T>
+  void WriteNumber(T value);
+
+  void FlushBuffer(size_t needed = 0);
 };
 
 }
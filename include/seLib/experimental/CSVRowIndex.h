@@ -0,0 +1,90 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+struct CSVRowIndexHeader {
+  char Magic[4];
+  uint32_t Version;
+  uint64_t SourceSize;
+  int64_t SourceModified;  // nanoseconds since the epoch
+  uint64_t Rows;
+  uint32_t Interval;
+  char Separator;
+  uint8_t ParseQuotes;
+  uint8_t Reserved[2];
+};
+
+// Byte offsets of every Interval-th row of a CSV file. Rows are counted as
+// CSVReader::ReadRow returns them: a row ends at a line break outside quotes
+// and not escaped, and empty lines are rows. The index can be saved next to
+// the file as a small sidecar of a header followed by the offsets.
+class CSVRowIndex {
+public:
+  static const uint32_t Version = 1;
+
+  uint32_t Interval = 1024;
+  char Separator = ',';
+  bool ParseQuotes = true;
+  uint64_t SourceSize = 0;
+  int64_t SourceModified = 0;
+  uint64_t Rows = 0;
+  // Offsets[i] is the start of row i * Interval.
+  vector<uint64_t> Offsets;
+
+  // Where the index of a CSV file is kept.
+  static string PathFor(const string& source) {
+    return source + ".csvi";
+  }
+
+  // Index source, finding row ends with CSVStructuralIndexer.
+  void Build(const string& source, uint32_t interval = 1024, char separator = ',', bool parseQuotes = true);
+
+  // Index a buffer already in memory.
+  void BuildBuffer(const char* data, size_t size, uint32_t interval = 1024, char separator = ',', bool parseQuotes = true);
+
+  void Save(const string& path) const;
+
+  // Load an index saved by Save. Throws if it is not a valid index.
+  void Load(const string& path);
+
+  // True if path holds an index of source as it is now.
+  static bool IsCurrent(const string& source, const string& path);
+
+  // Load the index of source if it is current, otherwise build and save it.
+  void Open(const string& source, uint32_t interval = 1024, char separator = ',', bool parseQuotes = true);
+
+  // Start of the last indexed row at or before row; sets indexedRow to its
+  // number.
+  inline uint64_t Locate(uint64_t row, uint64_t& indexedRow) const {
+    size_t i = (size_t)(row / Interval);
+    if (i >= Offsets.size())
+      i = Offsets.size() - 1;
+    indexedRow = (uint64_t)i * Interval;
+    return Offsets[i];
+  }
+};
+
+}
+}
@@ -0,0 +1,188 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+// Binary columnar copy of a CSV file. The file holds a header, a table of
+// columns, the column names, and then each numeric column as one array of
+// little-endian values aligned to 64 bytes, optionally followed by the
+// minimum and maximum of every block of BlockRows values and a bitmap of the
+// missing cells. Columns that are not entirely numeric are listed but not
+// stored.
+
+enum class CSVSidecarType : uint32_t {
+  Text = 0,    // not stored
+  Int64 = 1,
+  Double = 2,  // missing cells are NaN
+};
+
+enum CSVSidecarFlags : uint32_t {
+  // Every value narrowed to float is what from_chars<float> gives for its
+  // cell, without an error.
+  CSVSidecarFloatExact = 1,
+};
+
+struct CSVSidecarHeader {
+  char Magic[4];
+  uint32_t Version;
+  uint64_t SourceSize;
+  int64_t SourceModified;  // nanoseconds since the epoch
+  uint64_t Rows;           // data rows, without the header and empty lines
+  uint32_t Columns;
+  uint32_t BlockRows;
+  char Separator;
+  uint8_t ParseQuotes;
+  uint8_t HeaderRow;
+  uint8_t Reserved[5];
+};
+
+struct CSVSidecarColumn {
+  uint32_t Type;
+  uint32_t NameLength;
+  uint64_t NameOffset;
+  uint64_t DataOffset;   // 0 for text columns
+  uint64_t StatsOffset;  // 0 if there are no block statistics
+  uint64_t MissingOffset;  // bit per row set for missing cells; 0 if none are
+  uint32_t Flags;
+  uint32_t Reserved;
+};
+
+struct CSVSidecarStats {
+  double Min;  // NaN if the block has no values
+  double Max;
+};
+
+struct CSVSidecarOptions {
+  char Separator = ',';
+  bool ParseQuotes = true;
+  // The first row holds column names.
+  bool HeaderRow = false;
+  uint32_t BlockRows = 65536;
+  bool BlockStats = true;
+};
+
+class CSVSidecar {
+protected:
+  const uint8_t* _Data = nullptr;
+  size_t _Size = 0;
+  const CSVSidecarHeader* _Header = nullptr;
+  const CSVSidecarColumn* _Columns = nullptr;
+
+public:
+  static const uint32_t Version = 2;
+
+  CSVSidecar() { }
+
+  CSVSidecar(const CSVSidecar&) = delete;
+  CSVSidecar& operator=(const CSVSidecar&) = delete;
+
+  ~CSVSidecar();
+
+  // Where the sidecar of a CSV file is kept.
+  static string PathFor(const string& source) {
+    return source + ".csvc";
+  }
+
+  // Parse source once and write its sidecar to path. Integer columns are
+  // stored as Int64 and other numeric columns as Double; a "-0" cell makes a
+  // column Double so that the sign of zero is kept.
+  static void Convert(const string& source, const string& path, const CSVSidecarOptions& options = CSVSidecarOptions());
+
+  // True if path is a sidecar of source as it is now: newer than source and
+  // recording its current size and modification time.
+  static bool IsCurrent(const string& source, const string& path);
+
+  // Map a sidecar. Throws if it is not a valid sidecar file.
+  void Open(const string& path);
+
+  void Close();
+
+  inline const CSVSidecarHeader& Header() const {
+    return *_Header;
+  }
+
+  inline size_t Rows() const {
+    return (size_t)_Header->Rows;
+  }
+
+  inline size_t ColumnCount() const {
+    return _Header->Columns;
+  }
+
+  inline CSVSidecarType Type(size_t column) const {
+    return (CSVSidecarType)_Columns[column].Type;
+  }
+
+  inline string_view Name(size_t column) const {
+    return string_view((const char*)_Data + _Columns[column].NameOffset, _Columns[column].NameLength);
+  }
+
+  // Index of the named column, or -1.
+  int Find(string_view name) const;
+
+  // Values of a column, or nullptr if it is not of that type.
+  inline const int64_t* Int64s(size_t column) const {
+    if (Type(column) != CSVSidecarType::Int64)
+      return nullptr;
+    return (const int64_t*)(_Data + _Columns[column].DataOffset);
+  }
+
+  inline const double* Doubles(size_t column) const {
+    if (Type(column) != CSVSidecarType::Double)
+      return nullptr;
+    return (const double*)(_Data + _Columns[column].DataOffset);
+  }
+
+  // True if the cell is missing: empty, or beyond the end of its row. A
+  // "nan" cell is a value.
+  inline bool IsMissing(size_t column, size_t row) const {
+    if (_Columns[column].MissingOffset == 0)
+      return false;
+    const uint64_t* bits = (const uint64_t*)(_Data + _Columns[column].MissingOffset);
+    return (bits[row / 64] >> (row % 64)) & 1;
+  }
+
+  inline bool HasMissing(size_t column) const {
+    return _Columns[column].MissingOffset != 0;
+  }
+
+  inline bool FloatExact(size_t column) const {
+    return (_Columns[column].Flags & CSVSidecarFloatExact) != 0;
+  }
+
+  inline size_t BlockCount() const {
+    return (Rows() + _Header->BlockRows - 1) / _Header->BlockRows;
+  }
+
+  // Per-block statistics of a column, or nullptr if there are none.
+  inline const CSVSidecarStats* Stats(size_t column) const {
+    if (_Columns[column].StatsOffset == 0)
+      return nullptr;
+    return (const CSVSidecarStats*)(_Data + _Columns[column].StatsOffset);
+  }
+};
+
+}
+}
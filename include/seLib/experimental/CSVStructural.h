@@ -0,0 +1,191 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+// Bitmasks of one 64-byte block, bit i for byte i.
+struct CSVBlockMasks {
+  uint64_t Separator;
+  uint64_t Quote;
+  uint64_t Backslash;
+  uint64_t Newline;
+};
+
+// Finds the structural characters of a CSV buffer - separators and newlines
+// outside quotes and not escaped by a backslash - 64 bytes at a time. Each
+// block is classified into bitmasks with AVX2 or SSE2 compares (bytewise
+// without SSE2), escaped characters are found with carry-propagating
+// arithmetic on the backslash mask, and the inside of quotes with a prefix
+// XOR of the quote mask, so there are no per-byte branches. Quote and escape
+// state carries over between Index calls on consecutive buffers.
+class CSVStructuralIndexer {
+public:
+  char Separator = ',';
+  bool ParseQuotes = true;
+  // All ones while inside quotes at the end of the last block.
+  uint64_t InQuote = 0;
+  // 1 if the first byte of the next block is escaped.
+  uint64_t Escaped = 0;
+
+  static const size_t BlockSize = 64;
+
+  CSVStructuralIndexer() { }
+
+  CSVStructuralIndexer(char separator, bool parseQuotes) :
+    Separator(separator), ParseQuotes(parseQuotes)
+  { }
+
+  inline void Reset() {
+    InQuote = 0;
+    Escaped = 0;
+  }
+
+  // Write the offsets, relative to data, of the structural characters in
+  // data[0, len) to the start of positions, growing it if needed, and return
+  // how many there are. len must be below 4 GB, and a multiple of BlockSize
+  // unless this is the last buffer of the input.
+  size_t Index(const char* data, size_t len, vector<uint32_t>& positions);
+
+  // Structural mask of one block, updating the carried state.
+  inline uint64_t Structurals(const CSVBlockMasks& masks) {
+    uint64_t escaped = FindEscaped(masks.Backslash, Escaped);
+    uint64_t quotes = ParseQuotes ? (masks.Quote & ~escaped) : 0;
+    uint64_t inquote = PrefixXor(quotes) ^ InQuote;
+    InQuote = (uint64_t)((int64_t)inquote >> 63);
+    return (masks.Separator | masks.Newline) & ~inquote & ~escaped;
+  }
+
+  // Bit i is set if an odd number of bits at or below i are set.
+  static inline uint64_t PrefixXor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+  }
+
+  // Characters preceded by an odd-length run of backslashes. carry is 1 if
+  // the block starts with an escaped character and is set for the next block.
+  static inline uint64_t FindEscaped(uint64_t backslash, uint64_t& carry) {
+    const uint64_t evenBits = 0x5555555555555555ULL;
+    backslash &= ~carry;
+    uint64_t followsEscape = (backslash << 1) | carry;
+    uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+    uint64_t evenStarts;
+    carry = __builtin_add_overflow(oddStarts, backslash, &evenStarts) ? 1 : 0;
+    uint64_t invert = evenStarts << 1;
+    return (evenBits ^ invert) & followsEscape;
+  }
+
+  static inline void Classify(const char* block, char separator, CSVBlockMasks& masks) {
+#if defined(__AVX2__)
+    __m256i lo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    auto mask = [lo, hi](char c) {
+      __m256i pattern = _mm256_set1_epi8(c);
+      uint64_t l = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, pattern));
+      uint64_t h = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, pattern));
+      return l | (h << 32);
+    };
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i b0 = _mm_loadu_si128((const __m128i*)block);
+    __m128i b1 = _mm_loadu_si128((const __m128i*)(block + 16));
+    __m128i b2 = _mm_loadu_si128((const __m128i*)(block + 32));
+    __m128i b3 = _mm_loadu_si128((const __m128i*)(block + 48));
+    auto mask = [b0, b1, b2, b3](char c) {
+      __m128i pattern = _mm_set1_epi8(c);
+      uint64_t m0 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b0, pattern));
+      uint64_t m1 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b1, pattern));
+      uint64_t m2 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b2, pattern));
+      uint64_t m3 = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b3, pattern));
+      return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+    };
+#else
+    auto mask = [block](char c) {
+      uint64_t bits = 0;
+      for (size_t i = 0; i < BlockSize; i++)
+        bits |= (uint64_t)(block[i] == c) << i;
+      return bits;
+    };
+#endif
+    masks.Separator = mask(separator);
+    masks.Quote = mask('\"');
+    masks.Backslash = mask('\\');
+    masks.Newline = mask('\n');
+  }
+};
+
+// Walks the structural positions of a buffer in order, indexing it a window
+// at a time from a starting offset.
+class CSVStructuralCursor {
+public:
+  CSVStructuralIndexer Indexer;
+  const char* Data = nullptr;
+  size_t Size = 0;
+  vector<uint32_t> Positions;
+  size_t Count = 0;
+  size_t Current = 0;
+  size_t Base = 0;
+  size_t IndexedTo = 0;
+
+  // Bytes indexed at a time; a multiple of CSVStructuralIndexer::BlockSize.
+  static const size_t Window = 256 * 1024;
+
+  // Start at from, which must not be inside quotes or escaped.
+  void Reset(const char* data, size_t size, size_t from, char separator, bool parseQuotes) {
+    Indexer = CSVStructuralIndexer(separator, parseQuotes);
+    Data = data;
+    Size = size;
+    Count = 0;
+    Current = 0;
+    Base = from;
+    IndexedTo = from;
+  }
+
+  // Offset of the next structural character. Returns false at the end.
+  inline bool Next(size_t& position) {
+    while (Current == Count) {
+      if (IndexedTo >= Size)
+        return false;
+      size_t len = Size - IndexedTo;
+      if (len > Window)
+        len = Window;
+      Base = IndexedTo;
+      Count = Indexer.Index(Data + Base, len, Positions);
+      Current = 0;
+      IndexedTo += len;
+    }
+    position = Base + Positions[Current++];
+    return true;
+  }
+};
+
+}
+}
@@ -0,0 +1,79 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <seLib/RefObj.h>
+
+namespace seLib {
+namespace Checksum {
+
+// CRC-32C (Castagnoli) of len bytes. Pass the result of a previous call as crc
+// to continue a checksum over several buffers. Uses the SSE4.2 or ARMv8 CRC32
+// instructions when the CPU has them, and slicing-by-8 tables otherwise.
+uint32_t Crc32c(const uint8_t* data, size_t len, uint32_t crc = 0);
+
+// Table-driven CRC-32C, regardless of hardware support.
+uint32_t Crc32cSoftware(const uint8_t* data, size_t len, uint32_t crc = 0);
+
+// True if Crc32c uses the CPU's CRC32 instructions.
+bool Crc32cHardware();
+
+// Crc32c over a message followed by its own little endian CRC-32C always
+// yields this value, so a frame and its trailer can be checked in one pass.
+static const uint32_t Crc32cResidue = 0x48674BC7u;
+
+// Adler-32 as used by zlib. Pass a previous result as adler to continue.
+uint32_t Adler32(const uint8_t* data, size_t len, uint32_t adler = 1);
+
+// Fletcher-16 over bytes.
+uint16_t Fletcher16(const uint8_t* data, size_t len, uint16_t sum = 0);
+
+// Fletcher-32 over little endian 16-bit words. An odd trailing byte is padded
+// with zero.
+uint32_t Fletcher32(const uint8_t* data, size_t len, uint32_t sum = 0);
+
+inline void StoreLE32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+inline uint32_t LoadLE32(const uint8_t* in) {
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+inline uint32_t Crc32c(const BufferView& view, uint32_t crc = 0) {
+    return Crc32c(*view, view.size(), crc);
+}
+
+inline uint32_t Adler32(const BufferView& view, uint32_t adler = 1) {
+    return Adler32(*view, view.size(), adler);
+}
+
+inline uint16_t Fletcher16(const BufferView& view, uint16_t sum = 0) {
+    return Fletcher16(*view, view.size(), sum);
+}
+
+inline uint32_t Fletcher32(const BufferView& view, uint32_t sum = 0) {
+    return Fletcher32(*view, view.size(), sum);
+}
+
+}
+}
@@ -15,23 +15,120 @@
    limitations under the License.
 */
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string_view>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 namespace seLib {
 
 using namespace std;
 
+// Element type of a DataSet whose values are stored contiguously.
+enum class DataSetType {
+	Generic,	// only to_string is available
+	Float,
+	Double,
+	Int8,
+	Int16,
+	Int32,
+	Int64,
+	UInt8,
+	UInt16,
+	UInt32,
+	UInt64,
+};
+
+// Tag of an element type: floats and doubles by type, other integers by size
+// and signedness, so char, long and long long share the tag of the matching
+// fixed-width type. bool and everything else is Generic.
+template <typename T>
+struct DataSetTypeOf {
+	static constexpr int SizeIndex = (sizeof(T) == 1) ? 0 : (sizeof(T) == 2) ? 1 : (sizeof(T) == 4) ? 2 : (sizeof(T) == 8) ? 3 : -1;
+
+	static constexpr DataSetType Value =
+		is_same<T, float>::value ? DataSetType::Float :
+		is_same<T, double>::value ? DataSetType::Double :
+		(!is_integral<T>::value || is_same<T, bool>::value || SizeIndex < 0) ? DataSetType::Generic :
+		is_signed<T>::value ? (DataSetType)((int)DataSetType::Int8 + SizeIndex) :
+		(DataSetType)((int)DataSetType::UInt8 + SizeIndex);
+};
+
+// Read-only view of contiguous elements, valid until the set is modified.
+template <typename T>
+class DataSpan {
+protected:
+	const T* _Data;
+	size_t _Size;
+public:
+	DataSpan() : _Data(nullptr), _Size(0) {}
+
+	DataSpan(const T* data, size_t size) : _Data(data), _Size(size) {}
+
+	const T* data() const { return _Data; }
+	size_t size() const { return _Size; }
+	bool empty() const { return _Size == 0; }
+	const T* begin() const { return _Data; }
+	const T* end() const { return _Data + _Size; }
+	const T& operator[](size_t index) const { return _Data[index]; }
+};
+
 class DataSet {
 public:
 	virtual size_t size() = 0;
 	virtual string Name() = 0;
 	virtual string Name(size_t index) = 0;
 	virtual string to_string(size_t index) = 0;
+
+	// Sets that are a TypedDataSet of an arithmetic type report it here, and
+	// RawData points to their size() elements of that type.
+	virtual DataSetType Type() {
+		return DataSetType::Generic;
+	}
+
+	virtual const void* RawData() {
+		return nullptr;
+	}
+
+	// The elements as T, or an empty span if the set does not hold T.
+	template <typename T>
+	DataSpan<T> As();
 };
 
+// A DataSet whose elements are stored contiguously as T, so consumers can read
+// them all through one call to data() instead of a to_string per element.
 template <typename T>
-class ScalarDataSet : public DataSet {
+class TypedDataSet : public DataSet {
+public:
+	virtual DataSpan<T> data() = 0;
+
+	DataSetType Type() override {
+		return DataSetTypeOf<T>::Value;
+	}
+
+	const void* RawData() override {
+		return data().data();
+	}
+};
+
+template <typename T>
+DataSpan<T> DataSet::As() {
+	// A tag identifies the representation, so arithmetic types need no cast.
+	if constexpr (DataSetTypeOf<T>::Value != DataSetType::Generic) {
+		if (Type() != DataSetTypeOf<T>::Value)
+			return DataSpan<T>();
+		return DataSpan<T>((const T*)RawData(), size());
+	} else {
+		if (auto typed = dynamic_cast<TypedDataSet<T>*>(this))
+			return typed->data();
+		return DataSpan<T>();
+	}
+}
+
+template <typename T>
+class ScalarDataSet : public TypedDataSet<T> {
 protected:
 	string _Name;
 public:
@@ -57,10 +154,19 @@ public:
 	string to_string(size_t index) override {
 		return std::to_string(Value);
 	}
+
+	DataSpan<T> data() override {
+		return DataSpan<T>(&Value, 1);
+	}
 };
 
+// vector<bool> is not stored contiguously, so ArrayDataSet<bool> is only a
+// DataSet.
 template <typename T>
-class ArrayDataSet : public DataSet {
+using ArrayDataSetBase = typename conditional<is_same<T, bool>::value, DataSet, TypedDataSet<T>>::type;
+
+template <typename T>
+class ArrayDataSet : public ArrayDataSetBase<T> {
 protected:
 	string _Name;
 public:
@@ -85,6 +191,11 @@ public:
 	string to_string(size_t index) override {
 		return std::to_string(Data[index]);
 	}
+
+	// Overrides TypedDataSet<T>::data(); never instantiated for bool.
+	DataSpan<T> data() {
+		return DataSpan<T>(Data.data(), Data.size());
+	}
 };
 
 }
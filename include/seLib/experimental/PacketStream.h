@@ -26,15 +26,22 @@ namespace seLib {
 #endif
 #endif
 
+struct PacketStreamDescriptor;
+
 // Receiver function for PacketStream packets.
 typedef void(*PacketStreamCallback)(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference);
 
-struct PacketStreamDescriptor;
-
+// Batched receiver function for PacketStream packets. Receives a contiguous run
+// of packetcount packets, each descriptor.PacketSize bytes long.
+typedef void(*PacketStreamBatchCallback)(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference);
 
+// Either callback may be null, but not both. A receiver without a batch
+// callback is called once per packet by NotifyBatch, and a receiver with only a
+// batch callback is called with a run of one packet by Notify.
 struct PacketStreamReceiver {
     PacketStreamCallback callback;
     void* reference;
+    PacketStreamBatchCallback batchcallback;
 };
 
 #ifdef __cplusplus
@@ -54,9 +61,88 @@ struct PacketStreamDescriptor {
     void Notify(const void* buffer) const {
         for (int i = 0; i < ReceiverCount; i++) {
             auto t = Receivers[i];
-            t.callback(*this, (const uint8_t*)buffer, t.reference);
+            if (t.callback != nullptr)
+                t.callback(*this, (const uint8_t*)buffer, t.reference);
+            else
+                t.batchcallback(*this, (const uint8_t*)buffer, 1, t.reference);
         }
     }
+
+    // Deliver a contiguous run of count packets. Each receiver sees the whole
+    // run before the next receiver is called.
+    void NotifyBatch(const void* buffer, size_t count) const {
+        for (int i = 0; i < ReceiverCount; i++) {
+            auto t = Receivers[i];
+            if (t.batchcallback != nullptr) {
+                t.batchcallback(*this, (const uint8_t*)buffer, count, t.reference);
+                continue;
+            }
+            const uint8_t* packet = (const uint8_t*)buffer;
+            for (size_t n = 0; n < count; n++, packet += PacketSize)
+                t.callback(*this, packet, t.reference);
+        }
+    }
+};
+
+// Compile-time receiver wrapping a C-compatible callback. The callback and
+// reference are template arguments, so calls are direct and can be inlined.
+// Reference may be any constant pointer, e.g. the address of a global.
+template <PacketStreamCallback Callback, auto Reference = nullptr>
+struct StaticPacketStreamReceiver {
+    static inline void Receive(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata) {
+        Callback(descriptor, packetdata, (void*)Reference);
+    }
+};
+
+// Fixed, type-level receiver list for topologies known at compile time. Each
+// receiver type provides
+//   static void Receive(const PacketStreamDescriptor&, const uint8_t*);
+// Notify calls them in order as direct calls, then any dynamic receivers of
+// Descriptor. This is not itself a PacketStreamDescriptor: routers, frame
+// decoders, shared memory readers, replayers and async streams deliver through
+// a descriptor's receiver table, and reach the static receivers only through
+// the entry returned by Receiver().
+template <typename... Receivers_T>
+struct StaticPacketStreamDescriptor {
+    // Passed to the receivers; its own Receivers are called after them.
+    PacketStreamDescriptor Descriptor;
+
+    constexpr StaticPacketStreamDescriptor(int packettype, size_t packetsize, int receivercount = 0, PacketStreamReceiver const * receivers = nullptr) :
+        Descriptor { packettype, packetsize, receivercount, receivers }
+    {}
+
+    inline void Notify(const void* buffer) const {
+        (Receivers_T::Receive(Descriptor, (const uint8_t*)buffer), ...);
+        if (Descriptor.ReceiverCount > 0)
+            Descriptor.Notify(buffer);
+    }
+
+    // Each receiver sees the whole run before the next receiver is called.
+    inline void NotifyBatch(const void* buffer, size_t count) const {
+        (ReceiveRun<Receivers_T>((const uint8_t*)buffer, count), ...);
+        if (Descriptor.ReceiverCount > 0)
+            Descriptor.NotifyBatch(buffer, count);
+    }
+
+    // Receiver entry forwarding another descriptor's packets to this one.
+    inline PacketStreamReceiver Receiver() const {
+        return PacketStreamReceiver { &Forward, (void*)this, &ForwardBatch };
+    }
+
+protected:
+    template <typename Receiver_T>
+    inline void ReceiveRun(const uint8_t* packet, size_t count) const {
+        for (size_t n = 0; n < count; n++, packet += Descriptor.PacketSize)
+            Receiver_T::Receive(Descriptor, packet);
+    }
+
+    static void Forward(const PacketStreamDescriptor& /*descriptor*/, const uint8_t* packetdata, void* reference) {
+        ((const StaticPacketStreamDescriptor*)reference)->Notify(packetdata);
+    }
+
+    static void ForwardBatch(const PacketStreamDescriptor& /*descriptor*/, const uint8_t* packetdata, size_t packetcount, void* reference) {
+        ((const StaticPacketStreamDescriptor*)reference)->NotifyBatch(packetdata, packetcount);
+    }
 };
 
 }
@@ -0,0 +1,253 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <seLib/RefObj.h>
+#include <seLib/experimental/BoundedQueue.h>
+#include <seLib/experimental/PacketStream.h>
+#include <seLib/experimental/PacketStreamPool.h>
+#include <seLib/experimental/PacketStreamStats.h>
+
+namespace seLib {
+
+using namespace std;
+
+class AsyncPacketStream;
+class PacketStreamWorkerPool;
+
+// Delivery order guarantee for an AsyncPacketStream.
+enum class PacketStreamOrdering {
+    // Each receiver sees packets in Notify order, one callback at a time.
+    PerReceiver,
+    // Any idle worker may deliver the next packet, so callbacks for the same
+    // receiver can run concurrently and complete out of order.
+    Unordered,
+};
+
+// Action taken by Notify when a receiver queue is full.
+enum class PacketStreamOverflow {
+    // Discard the oldest queued packet to make room for the new one.
+    DropOldest,
+    // Wait for a worker to make room. Notify is no longer constant-time.
+    Block,
+    // Discard the new packet and count it.
+    CountAndDrop,
+};
+
+struct AsyncPacketStreamOptions {
+    size_t QueueSize = 1024;
+    PacketStreamOrdering Ordering = PacketStreamOrdering::PerReceiver;
+    PacketStreamOverflow Overflow = PacketStreamOverflow::CountAndDrop;
+    // Maximum number of queue entries a worker delivers from one queue before
+    // moving on to the next, to keep one busy receiver from starving the others.
+    size_t DrainBatch = 32;
+    // Packet pool for queued copies. Packets that already live in the pool are
+    // queued by reference without a copy, other runs are copied into pool
+    // slots, SlotPackets at a time. If null, the stream creates its own pool
+    // with a slot for every queue entry. Notify never allocates: when no slot
+    // is free the run counts as an overflow, so Block waits for a slot and the
+    // other policies drop the run for every receiver.
+    PacketStreamPool* Pool = nullptr;
+    // Packets per slot of the pool the stream creates.
+    size_t SlotPackets = 1;
+};
+
+// Queued run of Count packets stored contiguously at Data, inside Buffer. Each
+// entry holds one reference to the buffer.
+struct AsyncPacketStreamEntry {
+    RefBuffer* Buffer;
+    const uint8_t* Data;
+    size_t Count;
+    // Only set if some queue of the stream collects statistics.
+    PacketStreamStats::Clock::time_point Queued;
+};
+
+// Per-receiver packet queue of an AsyncPacketStream. A receiver wrapped in a
+// PacketStreamStatsReceiver is unwrapped, and its statistics kept in Stats.
+struct AsyncPacketStreamQueue {
+    const PacketStreamDescriptor* Descriptor;
+    PacketStreamReceiver Receiver;
+    PacketStreamStats* Stats = nullptr;
+    PacketStreamOrdering Ordering;
+    size_t DrainBatch;
+    BoundedQueue<AsyncPacketStreamEntry> Queue;
+    atomic<bool> Draining { false };
+    atomic<uint64_t> Dropped { 0 };
+
+    AsyncPacketStreamQueue(const PacketStreamDescriptor* descriptor, PacketStreamReceiver receiver, const AsyncPacketStreamOptions& options) :
+        Descriptor(descriptor), Receiver(receiver), Ordering(options.Ordering), DrainBatch(options.DrainBatch), Queue(options.QueueSize)
+    {
+        if (auto wrapper = PacketStreamStatsReceiver::From(receiver)) {
+            Receiver = wrapper->Inner();
+            Stats = &wrapper->Stats();
+        }
+    }
+};
+
+//============================================================================
+// Pool of threads delivering queued packets for any number of
+// AsyncPacketStream instances.
+class PacketStreamWorkerPool {
+protected:
+    struct Worker {
+        thread Thread;
+        // Registry version the worker is using, or UINT64_MAX while idle.
+        atomic<uint64_t> SeenVersion { UINT64_MAX };
+    };
+
+    mutex _Lock;
+    condition_variable _Wake;
+    atomic<bool> _Running { false };
+    atomic<int> _Sleeping { 0 };
+    // Incremented for every NotifyBatch; idle workers sleep until it changes.
+    atomic<uint64_t> _Signals { 0 };
+    atomic<uint64_t> _Version { 0 };
+    vector<AsyncPacketStreamQueue*> _Queues;
+    vector<unique_ptr<Worker>> _Workers;
+
+    // Empty passes over the queues a worker makes before it sleeps.
+    static const unsigned IdlePolls = 64;
+
+    friend class AsyncPacketStream;
+
+public:
+    PacketStreamWorkerPool(unsigned threadcount);
+    PacketStreamWorkerPool(const PacketStreamWorkerPool&) = delete;
+    PacketStreamWorkerPool(PacketStreamWorkerPool&&) = delete;
+    PacketStreamWorkerPool& operator=(const PacketStreamWorkerPool&) = delete;
+    PacketStreamWorkerPool& operator=(PacketStreamWorkerPool&&) = delete;
+    ~PacketStreamWorkerPool();
+
+    // Stop and join all worker threads. Queued packets stay queued until their
+    // AsyncPacketStream is destroyed.
+    void Stop();
+
+    inline size_t ThreadCount() const {
+        return _Workers.size();
+    }
+
+protected:
+    void Attach(AsyncPacketStreamQueue* queue);
+    void Detach(AsyncPacketStreamQueue* queue);
+
+    // Called by producers after queueing packets, once per NotifyBatch. Only
+    // takes the lock and wakes a worker if one is asleep; workers poll for a
+    // while before they sleep, so under load they rarely are.
+    inline void Signal() {
+        _Signals.fetch_add(1);
+        if (_Sleeping.load() > 0) {
+            { lock_guard<mutex> lock(_Lock); }
+            _Wake.notify_one();
+        }
+    }
+
+    void WorkerMain(size_t index);
+    size_t Drain(AsyncPacketStreamQueue* queue);
+    template <bool Stats_T>
+    static size_t DrainEntries(AsyncPacketStreamQueue& queue);
+};
+
+//============================================================================
+// Asynchronous delivery of a PacketStreamDescriptor's packets. Each receiver of
+// the target descriptor gets its own lock-free queue, drained by the worker
+// pool, so a slow receiver no longer stalls the producing thread. Notify copies
+// the packet once into a reference counted buffer shared by all queues (or
+// takes a reference to an existing RefBuffer) and is constant-time and
+// allocation free except with PacketStreamOverflow::Block.
+//
+// Notify is intended to be called from one producer thread per stream. The
+// stream can also be placed in another descriptor's receiver table through
+// Receiver(), making that descriptor's Notify enqueue into this stream.
+class AsyncPacketStream {
+protected:
+    const PacketStreamDescriptor& _Descriptor;
+    PacketStreamWorkerPool& _Pool;
+    AsyncPacketStreamOptions _Options;
+    unique_ptr<PacketStreamPool> _OwnedPool;
+    PacketStreamPool* _PacketPool;
+    size_t _SlotPackets = 0;
+    vector<unique_ptr<AsyncPacketStreamQueue>> _Queues;
+    // Some queue collects statistics, so entries are timestamped and pushed
+    // with Push<true>.
+    bool _Timed = false;
+
+public:
+    AsyncPacketStream(const PacketStreamDescriptor& descriptor, PacketStreamWorkerPool& pool, const AsyncPacketStreamOptions& options = AsyncPacketStreamOptions());
+    AsyncPacketStream(const AsyncPacketStream&) = delete;
+    AsyncPacketStream(AsyncPacketStream&&) = delete;
+    AsyncPacketStream& operator=(const AsyncPacketStream&) = delete;
+    AsyncPacketStream& operator=(AsyncPacketStream&&) = delete;
+    ~AsyncPacketStream();
+
+    // Queue a copy of a PacketSize byte packet for every receiver.
+    void Notify(const void* buffer);
+
+    // Queue a reference to an existing packet buffer for every receiver.
+    void Notify(RefBuffer* buffer);
+
+    // Queue a copy of a contiguous run of count packets for every receiver.
+    // The run takes a single queue slot and is delivered to batch receivers
+    // in one call.
+    void NotifyBatch(const void* buffer, size_t count);
+
+    // Queue a reference to an existing buffer holding count packets at
+    // packetdata (or at the start of the buffer if packetdata is null).
+    void NotifyBatch(RefBuffer* buffer, size_t count, const uint8_t* packetdata = nullptr);
+
+    inline const PacketStreamDescriptor& Descriptor() const {
+        return _Descriptor;
+    }
+
+    // Receiver entry that forwards another descriptor's packets into this
+    // stream.
+    inline PacketStreamReceiver Receiver() {
+        return PacketStreamReceiver { &AsyncPacketStream::Callback, this, &AsyncPacketStream::BatchCallback };
+    }
+
+    static void Callback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference);
+    static void BatchCallback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference);
+
+    // Number of packets discarded by the overflow policy for a receiver.
+    inline uint64_t DropCount(int receiver) const {
+        return _Queues[receiver]->Dropped.load(memory_order_relaxed);
+    }
+
+    // Approximate number of queue entries (single packets or batched runs)
+    // waiting for a receiver.
+    inline size_t QueueDepth(int receiver) const {
+        return _Queues[receiver]->Queue.size();
+    }
+
+protected:
+    // Queue a run held by the caller for every receiver and wake a worker.
+    void Enqueue(RefBuffer* buffer, size_t count, const uint8_t* packetdata);
+    // Queue an entry for one receiver. Returns true if it was queued. With
+    // Stats_T false no statistics are kept; that instantiation is used when no
+    // queue of the stream has any.
+    template <bool Stats_T>
+    bool Push(AsyncPacketStreamQueue& queue, const AsyncPacketStreamEntry& entry);
+    void Drop(size_t count);
+};
+
+}
@@ -0,0 +1,183 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include <seLib/experimental/PacketStream.h>
+#include <seLib/experimental/PacketStreamRouter.h>
+
+namespace seLib {
+
+using namespace std;
+
+// Index of the first byte equal to value, or len if there is none. Compares
+// 32 or 16 bytes per step when AVX2 or SSE2 are available.
+inline size_t FindByte(const uint8_t* data, size_t len, uint8_t value) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i pattern32 = _mm256_set1_epi8((char)value);
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(data + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern32));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i pattern16 = _mm_set1_epi8((char)value);
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern16));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < len; i++) {
+        if (data[i] == value)
+            return i;
+    }
+    return len;
+}
+
+struct PacketFrameStats {
+    uint64_t Frames = 0;        // frames delivered to a descriptor
+    uint64_t FramingErrors = 0; // malformed frame encoding
+    uint64_t LengthErrors = 0;  // frame length does not match the descriptor's PacketSize
+    uint64_t UnknownTypes = 0;  // no descriptor registered for the frame's type
+    uint64_t Overruns = 0;      // frame longer than MaxFrameSize, discarded
+    uint64_t ChecksumErrors = 0; // integrity check failed
+};
+
+// Integrity check carried at the end of each frame.
+enum class PacketFrameIntegrity {
+    None,
+    // Little endian CRC-32C of the type field and packet.
+    Crc32c,
+};
+
+//============================================================================
+// Base class for frame decoders feeding a PacketStreamRouter. A decoded frame
+// holds the router's type field followed by exactly PacketSize bytes of packet
+// data, optionally followed by an integrity check, and the packet is passed to
+// the matching descriptor's Notify. Frames that end beyond the current receive
+// buffer are carried over to the next Decode call.
+class PacketFrameDecoder {
+protected:
+    const PacketStreamRouter& _Router;
+    vector<uint8_t> _Partial;
+    bool _Discarding = false;
+
+public:
+    size_t const MaxFrameSize;
+    PacketFrameIntegrity Integrity = PacketFrameIntegrity::None;
+    PacketFrameStats Stats;
+
+    PacketFrameDecoder(const PacketStreamRouter& router, size_t maxframesize) :
+        _Router(router), MaxFrameSize(maxframesize)
+    { }
+
+    virtual ~PacketFrameDecoder() { }
+
+    // Decode a receive buffer and deliver every complete frame. The buffer may
+    // be modified in place.
+    virtual void Decode(uint8_t* data, size_t len) = 0;
+
+    // Drop any partially received frame.
+    virtual void Reset() {
+        _Partial.clear();
+        _Discarding = false;
+    }
+
+    // Number of bytes of an incomplete frame waiting for the next Decode.
+    inline size_t PendingBytes() const {
+        return _Partial.size();
+    }
+
+protected:
+    // Deliver a decoded frame ([type field][packet][check]). verified is set
+    // when the integrity check was already done while decoding.
+    void Deliver(const uint8_t* frame, size_t len, bool verified = false);
+};
+
+//============================================================================
+// Decoder for COBS (consistent overhead byte stuffing) frames terminated by a
+// zero byte. Delimiters are located with FindByte and each frame is decoded in
+// place inside the receive buffer, so packets are delivered without copying
+// unless they straddle two Decode calls. A CRC-32C integrity check is computed
+// run by run while decoding, while the data is still in cache.
+class COBSFrameDecoder : public PacketFrameDecoder {
+public:
+    COBSFrameDecoder(const PacketStreamRouter& router, size_t maxframesize = 4096) :
+        PacketFrameDecoder(router, maxframesize)
+    { }
+
+    void Decode(uint8_t* data, size_t len) override;
+
+    // Decode a COBS frame (without its delimiter) in place. Returns the decoded
+    // length, or SIZE_MAX if the encoding is malformed. If crc is given, the
+    // CRC-32C of the decoded bytes is accumulated into it.
+    static size_t DecodeInPlace(uint8_t* frame, size_t len, uint32_t* crc = nullptr);
+
+    // Encode len bytes into out, followed by the zero delimiter. out must hold
+    // MaxEncodedSize(len) bytes. Returns the number of bytes written.
+    static size_t Encode(const uint8_t* data, size_t len, uint8_t* out);
+
+    static inline size_t MaxEncodedSize(size_t len) {
+        return len + len / 254 + 2;
+    }
+
+protected:
+    void DecodeFrame(uint8_t* frame, size_t len);
+};
+
+//============================================================================
+// Decoder for frames preceded by a header holding the little endian 16-bit
+// length of the frame that follows.
+class LengthPrefixFrameDecoder : public PacketFrameDecoder {
+protected:
+    // Bytes of an oversized frame still to be skipped.
+    size_t _Skip = 0;
+
+public:
+    static const size_t HeaderSize = 2;
+
+    LengthPrefixFrameDecoder(const PacketStreamRouter& router, size_t maxframesize = 4096) :
+        PacketFrameDecoder(router, maxframesize)
+    { }
+
+    void Decode(uint8_t* data, size_t len) override;
+
+    void Reset() override {
+        PacketFrameDecoder::Reset();
+        _Skip = 0;
+    }
+
+    static inline size_t FrameLength(const uint8_t* header) {
+        return header[0] | (header[1] << 8);
+    }
+
+    // Write the header and frame to out, which must hold HeaderSize + len
+    // bytes. Returns the number of bytes written.
+    static size_t Encode(const uint8_t* data, size_t len, uint8_t* out);
+};
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <seLib/experimental/PacketStream.h>
+
+namespace seLib {
+
+using namespace std;
+
+// Returns the timestamp of a packet, in any unit that increases with time.
+typedef int64_t(*PacketTimestampFunction)(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata);
+
+struct PacketStreamMergeOptions {
+    // Packets buffered per source. Rounded up to a power of two.
+    size_t QueueSize = 4096;
+    // How far (in timestamp units) the merge waits for a source that has
+    // fallen behind the others before emitting past it. Packets from such a
+    // source that arrive later than this are late. By default the merge waits
+    // for every source indefinitely.
+    int64_t Lateness = INT64_MAX;
+    // Maximum number of packets from one source delivered in one NotifyBatch.
+    size_t BatchSize = 64;
+    // When a source queue is full, wait for the merge (true) or drop the
+    // packet (false).
+    bool Block = false;
+    // Discard late packets instead of delivering them out of order.
+    bool DropLate = false;
+};
+
+//============================================================================
+// Merges several time-ordered packet streams into one stream in timestamp
+// order. Each source is attached to its descriptor with Receiver(source) and
+// copies packets into its own single-producer queue, so every source may run
+// on its own thread. Pump, called from a single merge thread, selects the
+// source with the earliest packet with a loser tree and delivers runs of
+// consecutive packets from one source to the output descriptor with
+// NotifyBatch.
+//
+// A packet is emitted once no source can still produce an earlier one: every
+// source with an empty queue has already seen a packet at least as late, or
+// has fallen more than Lateness behind the latest packet seen from any source.
+// All sources must carry packets of the output descriptor's PacketSize.
+class PacketStreamMerge {
+public:
+    struct Source {
+        PacketStreamMerge* Merge;
+        size_t Index;
+        unique_ptr<uint8_t[]> Packets;
+        unique_ptr<int64_t[]> Timestamps;
+        alignas(64) atomic<uint64_t> Head { 0 };
+        // Latest timestamp pushed, for the emission bound.
+        atomic<int64_t> Last { INT64_MIN };
+        atomic<uint64_t> Drops { 0 };
+        atomic<uint64_t> LengthErrors { 0 };
+        alignas(64) atomic<uint64_t> Tail { 0 };
+    };
+
+protected:
+    const PacketStreamDescriptor& _Output;
+    PacketTimestampFunction const _Timestamp;
+    PacketStreamMergeOptions const _Options;
+    size_t const _Mask;
+    vector<unique_ptr<Source>> _Sources;
+
+    // Loser tree over the sources' head timestamps. _Tree[0] is the winner,
+    // _Tree[1..] the loser of each match; leaves past the source count are
+    // padding that never wins.
+    size_t _Leaves;
+    vector<size_t> _Tree;
+    vector<int64_t> _Keys;
+    // Winner of each match while building, kept to avoid allocating per Pump.
+    vector<size_t> _Winners;
+    int64_t _LastEmitted = INT64_MIN;
+    // Queue snapshot taken at the start of each Pump.
+    vector<uint64_t> _Heads;
+    vector<int64_t> _Lasts;
+
+public:
+    uint64_t Packets = 0;
+    uint64_t Late = 0;
+    uint64_t LateDropped = 0;
+
+    PacketStreamMerge(const PacketStreamDescriptor& output, PacketTimestampFunction timestamp, size_t sourcecount,
+        const PacketStreamMergeOptions& options = PacketStreamMergeOptions());
+    PacketStreamMerge(const PacketStreamMerge&) = delete;
+    PacketStreamMerge(PacketStreamMerge&&) = delete;
+    PacketStreamMerge& operator=(const PacketStreamMerge&) = delete;
+    PacketStreamMerge& operator=(PacketStreamMerge&&) = delete;
+
+    inline size_t SourceCount() const {
+        return _Sources.size();
+    }
+
+    inline const Source& SourceAt(size_t source) const {
+        return *_Sources[source];
+    }
+
+    inline PacketStreamReceiver Receiver(size_t source) {
+        return PacketStreamReceiver { &PacketStreamMerge::Callback, _Sources[source].get(), &PacketStreamMerge::BatchCallback };
+    }
+
+    // Queue packets from a source. descriptor is the one they were notified
+    // on and is what the timestamp function sees. Returns false if any were
+    // dropped.
+    bool Push(size_t source, const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount = 1);
+
+    // Deliver up to maxpackets packets that are safe to emit and return how
+    // many were delivered. With flush set, every queued packet is delivered
+    // regardless of the sources that have nothing queued, e.g. at end of
+    // stream.
+    size_t Pump(size_t maxpackets = SIZE_MAX, bool flush = false);
+
+    // Pump until running becomes false, then flush.
+    void Run(const atomic<bool>& running);
+
+    static void Callback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference);
+    static void BatchCallback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference);
+
+protected:
+    inline bool Less(size_t a, size_t b) const {
+        return _Keys[a] < _Keys[b] || (_Keys[a] == _Keys[b] && a < b);
+    }
+
+    void Build();
+    void Replay(size_t leaf);
+    int64_t RunnerUp() const;
+    void Deliver(const uint8_t* packetdata, size_t packetcount);
+};
+
+}
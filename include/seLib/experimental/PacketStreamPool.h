@@ -0,0 +1,154 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <exception>
+#include <vector>
+
+#include <seLib/RefObj.h>
+#include <seLib/experimental/BoundedQueue.h>
+#include <seLib/experimental/PacketStream.h>
+
+namespace seLib {
+
+using namespace std;
+
+//============================================================================
+// Preallocated pool of reference counted packet buffers for a PacketStream.
+// Each slot holds SlotPackets packets of the descriptor's PacketSize. A slot
+// returns to the pool when the last RefBufferView referencing it is released,
+// so receivers can keep a packet beyond the callback without copying it:
+//
+//   RefBufferView packet = pool.Acquire();
+//   ... fill *packet ...
+//   descriptor.Notify(*packet);
+//
+//   // in a receiver callback
+//   RefBufferView kept = pool.Retain(packetdata);
+//
+// Acquire and slot recycling are lock-free. The pool must outlive every view
+// of its slots.
+class PacketStreamPool {
+protected:
+    class Slot : public RefBuffer {
+    protected:
+        PacketStreamPool& _Pool;
+
+    public:
+        Slot(PacketStreamPool& pool, uint8_t* data, size_t datasize) : RefBuffer(data, datasize), _Pool(pool) { }
+
+    protected:
+        void Free() override {
+            _Pool._Free.TryPush(this);
+        }
+    };
+
+    size_t const _PacketSize;
+    size_t const _SlotPackets;
+    size_t const _SlotStride;
+    uint8_t* _Storage;
+    uint8_t* _Start;
+    vector<Slot*> _Slots;
+    BoundedQueue<Slot*> _Free;
+
+public:
+    PacketStreamPool(const PacketStreamDescriptor& descriptor, size_t slotcount, size_t slotpackets = 1) :
+        PacketStreamPool(descriptor.PacketSize, slotcount, slotpackets)
+    { }
+
+    PacketStreamPool(size_t packetsize, size_t slotcount, size_t slotpackets = 1) :
+        _PacketSize(packetsize),
+        _SlotPackets(slotpackets),
+        _SlotStride((packetsize * slotpackets + 63) & ~(size_t)63), // keep slots on separate cache lines
+        _Free(slotcount)
+    {
+        if (packetsize == 0 || slotcount == 0 || slotpackets == 0)
+            throw exception();
+        _Storage = new uint8_t[_SlotStride * slotcount + 63];
+        _Start = (uint8_t*)(((uintptr_t)_Storage + 63) & ~(uintptr_t)63);
+        for (size_t i = 0; i < slotcount; i++) {
+            _Slots.push_back(new Slot(*this, _Start + i * _SlotStride, packetsize * slotpackets));
+            _Free.TryPush(_Slots.back());
+        }
+    }
+
+    PacketStreamPool(const PacketStreamPool&) = delete;
+    PacketStreamPool(PacketStreamPool&&) = delete;
+    PacketStreamPool& operator=(const PacketStreamPool&) = delete;
+    PacketStreamPool& operator=(PacketStreamPool&&) = delete;
+
+    ~PacketStreamPool() {
+        for (auto slot : _Slots)
+            delete slot;
+        delete[] _Storage;
+    }
+
+    // Take a free slot. Returns an empty view (size() == 0) if the pool is
+    // exhausted.
+    RefBufferView Acquire() {
+        Slot* slot;
+        if (!_Free.TryPop(slot))
+            return RefBufferView();
+        return RefBufferView(slot);
+    }
+
+    // Return true if the address lies inside one of the pool's slots.
+    inline bool Contains(const void* packetdata) const {
+        const uint8_t* p = (const uint8_t*)packetdata;
+        return p >= _Start && p < _Start + _SlotStride * _Slots.size();
+    }
+
+    // Slot buffer containing the address, or nullptr if it is not part of the
+    // pool.
+    inline RefBuffer* Find(const void* packetdata) const {
+        if (!Contains(packetdata))
+            return nullptr;
+        return _Slots[((const uint8_t*)packetdata - _Start) / _SlotStride];
+    }
+
+    // Take a new reference to the packet at packetdata, which must lie in a
+    // slot currently in use (for example the packet passed to a receiver
+    // callback).
+    RefBufferView Retain(const void* packetdata) const {
+        RefBuffer* slot = Find(packetdata);
+        if (slot == nullptr || slot->RefCount() == 0)
+            throw exception();
+        size_t offset = (const uint8_t*)packetdata - **slot;
+        if (offset + _PacketSize > slot->size())
+            throw exception();
+        return RefBufferView(slot, offset, _PacketSize);
+    }
+
+    inline size_t PacketSize() const {
+        return _PacketSize;
+    }
+
+    inline size_t SlotPackets() const {
+        return _SlotPackets;
+    }
+
+    inline size_t SlotCount() const {
+        return _Slots.size();
+    }
+
+    // Approximate number of free slots.
+    inline size_t Available() const {
+        return _Free.size();
+    }
+};
+
+}
@@ -0,0 +1,207 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Capture of PacketStream traffic to a binary file and replay through a
+// PacketStreamRouter.
+//
+// File layout (all fields little endian):
+//   PacketRecordFileHeader
+//   records: PacketRecordHeader, payload, zero padding to RecordAlignment
+//   index:   PacketRecordIndexEntry for every IndexInterval-th record
+//   PacketRecordFileTrailer
+// The index and trailer are written by Close. A file without them (from a
+// recorder that did not shut down cleanly), or whose trailer or index points
+// outside the file, can still be replayed; it is scanned up to the last
+// complete record.
+
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <seLib/experimental/PacketStream.h>
+#include <seLib/experimental/PacketStreamRouter.h>
+
+namespace seLib {
+
+using namespace std;
+
+struct PacketRecordFileHeader {
+    static const uint32_t MagicValue = 0x43525053; // "SPRC"
+    static const uint32_t VersionValue = 1;
+
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Reserved;
+};
+
+struct PacketRecordHeader {
+    int64_t Timestamp;  // nanoseconds, steady clock of the recording process
+    int32_t PacketType;
+    uint32_t Length;
+};
+
+struct PacketRecordIndexEntry {
+    int64_t Timestamp;
+    uint64_t Offset;    // file offset of the record
+};
+
+struct PacketRecordFileTrailer {
+    static const uint32_t MagicValue = 0x58525053; // "SPRX"
+
+    uint64_t IndexOffset;
+    uint64_t IndexCount;
+    uint64_t RecordCount;
+    uint32_t IndexInterval;
+    uint32_t Magic;
+};
+
+static const size_t PacketRecordAlignment = 8;
+
+inline size_t PacketRecordSize(size_t len) {
+    return (sizeof(PacketRecordHeader) + len + PacketRecordAlignment - 1) & ~(PacketRecordAlignment - 1);
+}
+
+//============================================================================
+// Appends packets to a record file through a write buffer, so a packet costs
+// a memcpy and the file sees one write(2) per BufferSize bytes. The receiver
+// from Receiver() records everything notified on the descriptors it is
+// attached to; it may be called from several threads.
+class PacketStreamRecorder {
+protected:
+    int _Fd = -1;
+    mutex _Lock;
+    vector<uint8_t> _Buffer;
+    size_t _Used = 0;
+    uint64_t _Offset = 0;
+    uint64_t _Records = 0;
+    vector<PacketRecordIndexEntry> _Index;
+
+public:
+    typedef chrono::steady_clock Clock;
+
+    size_t const IndexInterval;
+
+    PacketStreamRecorder(const string& path, size_t buffersize = 1 << 20, size_t indexinterval = 1024);
+    PacketStreamRecorder(const PacketStreamRecorder&) = delete;
+    PacketStreamRecorder& operator=(const PacketStreamRecorder&) = delete;
+    ~PacketStreamRecorder();
+
+    void Record(int packettype, const void* packetdata, size_t len, int64_t timestamp);
+
+    // Record with the current time, read under the lock so timestamps in the
+    // file never go backwards and Seek stays valid.
+    void Record(int packettype, const void* packetdata, size_t len);
+
+    // Write buffered records to the file.
+    void Flush();
+
+    // Flush, write the index and trailer, and close the file. The destructor
+    // does this too but ignores errors; call Close to see them.
+    void Close();
+
+    inline uint64_t Records() const {
+        return _Records;
+    }
+
+    inline PacketStreamReceiver Receiver() {
+        return PacketStreamReceiver { &PacketStreamRecorder::Callback, this, &PacketStreamRecorder::BatchCallback };
+    }
+
+    static void Callback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference);
+    static void BatchCallback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference);
+
+    static inline int64_t Now() {
+        return (int64_t)chrono::duration_cast<chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+protected:
+    void Append(int packettype, const void* packetdata, size_t len, int64_t timestamp);
+    void WriteBuffer();
+    void WriteAll(const void* data, size_t len);
+};
+
+struct PacketStreamReplayStats {
+    uint64_t Packets = 0;       // packets delivered to a descriptor
+    uint64_t Bytes = 0;         // payload bytes delivered
+    uint64_t UnknownTypes = 0;  // no descriptor registered for the record's type
+    uint64_t LengthErrors = 0;  // record length does not match the descriptor's PacketSize
+    double Seconds = 0;
+
+    inline double PacketsPerSecond() const {
+        return (Seconds > 0) ? Packets / Seconds : 0;
+    }
+
+    inline double BytesPerSecond() const {
+        return (Seconds > 0) ? Bytes / Seconds : 0;
+    }
+};
+
+//============================================================================
+// Replays a record file by mapping it and calling the matching descriptor's
+// Notify with a pointer into the mapping for each record, either as fast as
+// possible or at the recorded pace.
+class PacketStreamReplayer {
+protected:
+    int _Fd = -1;
+    const uint8_t* _Map = nullptr;
+    size_t _MapSize = 0;
+    // Bytes of the file holding complete records.
+    size_t _End = 0;
+    uint64_t _RecordCount = 0;
+    const PacketRecordIndexEntry* _Index = nullptr;
+    size_t _IndexCount = 0;
+
+public:
+    PacketStreamReplayer(const string& path);
+    PacketStreamReplayer(const PacketStreamReplayer&) = delete;
+    PacketStreamReplayer& operator=(const PacketStreamReplayer&) = delete;
+    ~PacketStreamReplayer();
+
+    // Deliver every record from the file offset start onwards (see Seek). If
+    // speed is greater than zero, records are delivered at the recorded pace
+    // scaled by speed (2.0 replays twice as fast); otherwise as fast as
+    // possible.
+    PacketStreamReplayStats Replay(const PacketStreamRouter& router, double speed = 0, size_t start = sizeof(PacketRecordFileHeader)) const;
+
+    // File offset of the first record with a timestamp at or after the given
+    // one, found through the index.
+    size_t Seek(int64_t timestamp) const;
+
+    inline uint64_t RecordCount() const {
+        return _RecordCount;
+    }
+
+    // True if the file has the index and trailer written by Close.
+    inline bool Indexed() const {
+        return _Index != nullptr;
+    }
+
+    inline const PacketRecordHeader* RecordAt(size_t offset) const {
+        return (const PacketRecordHeader*)(_Map + offset);
+    }
+
+    inline size_t End() const {
+        return _End;
+    }
+
+protected:
+    void Scan();
+};
+
+}
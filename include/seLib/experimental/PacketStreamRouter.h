@@ -0,0 +1,123 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdint.h>
+#include <vector>
+
+#include <seLib/experimental/PacketStream.h>
+
+namespace seLib {
+
+using namespace std;
+
+struct PacketStreamRouteResult {
+    // Bytes of the input that were routed.
+    size_t Consumed = 0;
+    // Number of packets delivered.
+    size_t Packets = 0;
+    // True if routing stopped at a packet with an unregistered type, rather
+    // than at an incomplete packet at the end of the input.
+    bool UnknownType = false;
+};
+
+//============================================================================
+// Maps PacketType values to their PacketStreamDescriptor. Lookup is a single
+// table access: registered types spanning at most MaxDenseSpan values are
+// stored in a dense array offset by the smallest type, and sparse types use a
+// multiplicative perfect hash computed at registration. Registration is meant
+// for setup time; lookups are safe from any number of threads once
+// registration is done.
+class PacketStreamRouter {
+protected:
+    vector<const PacketStreamDescriptor*> _Descriptors;
+    vector<const PacketStreamDescriptor*> _Table;
+    bool _Dense = true;
+    int _Base = 0;
+    uint32_t _Multiplier = 0;
+    int _Shift = 0;
+
+public:
+    // Size in bytes of the little endian PacketType field preceding each
+    // packet in a routed byte stream (1, 2 or 4).
+    size_t const TypeFieldSize;
+    size_t const MaxDenseSpan;
+
+    PacketStreamRouter(size_t typefieldsize = 1, size_t maxdensespan = 4096);
+
+    // Add a descriptor. Throws if its PacketType is already registered or no
+    // table can be built; the router is then left as it was.
+    void Register(const PacketStreamDescriptor& descriptor);
+
+    void Unregister(int packettype);
+
+    // Descriptor for the packet type, or nullptr if it is not registered.
+    inline const PacketStreamDescriptor* Find(int packettype) const {
+        size_t index;
+        if (_Dense)
+            index = (size_t)((unsigned)packettype - (unsigned)_Base);
+        else
+            index = ((uint32_t)packettype * _Multiplier) >> _Shift;
+        if (index >= _Table.size())
+            return nullptr;
+        const PacketStreamDescriptor* descriptor = _Table[index];
+        return (descriptor != nullptr && descriptor->PacketType == packettype) ? descriptor : nullptr;
+    }
+
+    // Deliver one packet to the descriptor registered for its type. Returns
+    // false if the type is not registered.
+    inline bool Route(int packettype, const void* packetdata) const {
+        const PacketStreamDescriptor* descriptor = Find(packettype);
+        if (descriptor == nullptr)
+            return false;
+        descriptor->Notify(packetdata);
+        return true;
+    }
+
+    // Route a byte stream of packets, each a TypeFieldSize type field followed
+    // by the PacketSize bytes of the registered descriptor. Packets are
+    // delivered in place without copying. Stops at an incomplete packet at the
+    // end of the input or at an unregistered type.
+    PacketStreamRouteResult RouteStream(const uint8_t* data, size_t len) const;
+
+    inline size_t size() const {
+        return _Descriptors.size();
+    }
+
+    inline const vector<const PacketStreamDescriptor*>& Descriptors() const {
+        return _Descriptors;
+    }
+
+    inline int ReadType(const uint8_t* field) const {
+        switch (TypeFieldSize) {
+        case 1:
+            return field[0];
+        case 2:
+            return field[0] | (field[1] << 8);
+        default:
+            return (int)((uint32_t)field[0] | ((uint32_t)field[1] << 8) | ((uint32_t)field[2] << 16) | ((uint32_t)field[3] << 24));
+        }
+    }
+
+protected:
+    // Build the table for descriptors and make them the registered set.
+    // Throws before changing anything if no table can be built.
+    void Rebuild(vector<const PacketStreamDescriptor*>& descriptors);
+    static bool TryHash(const vector<const PacketStreamDescriptor*>& descriptors, vector<const PacketStreamDescriptor*>& table,
+        uint32_t multiplier, int shift);
+};
+
+}
@@ -0,0 +1,203 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Shared memory PacketStream transport between local processes (Linux).
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include <seLib/experimental/PacketStream.h>
+#include <seLib/experimental/PacketStreamRouter.h>
+
+namespace seLib {
+
+using namespace std;
+
+// Control block at the start of a shared memory ring segment. Positions count
+// bytes written or read since creation; the ring offset is position & (Capacity - 1).
+struct SharedMemoryRingHeader {
+    static const uint32_t MagicValue = 0x52535053; // "SPSR"
+    static const uint32_t VersionValue = 1;
+
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Capacity;
+
+    alignas(64) atomic<uint64_t> Head;          // written by the producer
+    atomic<uint32_t> HeadSeq;                   // futex word, bumped on every publish
+    atomic<uint32_t> ConsumerWaiting;
+
+    alignas(64) atomic<uint64_t> Tail;          // written by the consumer
+    atomic<uint32_t> TailSeq;                   // futex word, bumped on every release
+    atomic<uint32_t> ProducerWaiting;
+};
+
+// Record header preceding each packet in the ring. Records are padded to
+// RecordAlignment bytes and never wrap; a Length of PadLength marks unused space
+// up to the end of the ring.
+struct SharedMemoryRecordHeader {
+    static const uint32_t PadLength = UINT32_MAX;
+
+    uint32_t Length;
+    int32_t PacketType;
+};
+
+//============================================================================
+// Mapping of a ring segment, created with shm_open (named) or memfd_create
+// (anonymous, shared by passing the file descriptor to the other process).
+class SharedMemoryRing {
+protected:
+    int _Fd = -1;
+    string _Name;
+    bool _Owner = false;
+    size_t _MappedSize = 0;
+    // Read from the header once, at open; the other process could change it.
+    size_t _Capacity = 0;
+    SharedMemoryRingHeader* _Header = nullptr;
+    uint8_t* _Data = nullptr;
+
+public:
+    static const size_t RecordAlignment = 8;
+    static const size_t DataOffset = 4096;
+
+    SharedMemoryRing() { }
+    SharedMemoryRing(const SharedMemoryRing&) = delete;
+    SharedMemoryRing& operator=(const SharedMemoryRing&) = delete;
+    ~SharedMemoryRing();
+
+    // Create a named segment with a data area of at least capacity bytes
+    // (rounded up to a power of two). The name is unlinked when this object
+    // is destroyed.
+    void Create(const string& name, size_t capacity);
+
+    // Create an anonymous segment; pass Fd() to the other process.
+    void CreateAnonymous(size_t capacity);
+
+    void Open(const string& name);
+
+    // Map a segment from a file descriptor received from the creating process.
+    // Throws if it is not a ring whose capacity is a power of two filling the
+    // segment.
+    void OpenFd(int fd);
+
+    void Close();
+
+    inline int Fd() const {
+        return _Fd;
+    }
+
+    inline SharedMemoryRingHeader& Header() const {
+        return *_Header;
+    }
+
+    inline uint8_t* Data() const {
+        return _Data;
+    }
+
+    inline size_t Capacity() const {
+        return _Capacity;
+    }
+
+    inline static size_t RecordSize(size_t packetlen) {
+        return (sizeof(SharedMemoryRecordHeader) + packetlen + RecordAlignment - 1) & ~(RecordAlignment - 1);
+    }
+
+    // Futex helpers on the shared ring words.
+    static bool Wait(atomic<uint32_t>& word, uint32_t expected, int timeout_ms);
+    static void Wake(atomic<uint32_t>& word);
+
+protected:
+    void Initialize(size_t capacity);
+    void Map(size_t size);
+};
+
+//============================================================================
+// Producer side of a ring. Packets are written in place with Reserve/Commit,
+// so a producer that builds packets directly in the ring makes no copies; the
+// PacketStreamReceiver from Receiver() copies each notified packet once.
+// The consumer is only woken (with a futex syscall) when it is asleep.
+// One producer thread per ring.
+class SharedMemoryPacketWriter {
+protected:
+    SharedMemoryRing& _Ring;
+    uint64_t _Head;
+    uint64_t _TailCache;
+    size_t _Reserved = 0;
+
+public:
+    // When the ring is full, wait for the consumer (true) or fail (false).
+    bool Block = true;
+    uint64_t Drops = 0;
+
+    SharedMemoryPacketWriter(SharedMemoryRing& ring);
+
+    // Reserve space for a packet and return where to write it, or nullptr if
+    // the ring is full and Block is false.
+    uint8_t* Reserve(int packettype, size_t len);
+
+    // Publish the reserved packet to the consumer.
+    void Commit();
+
+    // Copy a packet into the ring and publish it. Returns false if dropped.
+    bool Write(int packettype, const void* packetdata, size_t len);
+
+    inline PacketStreamReceiver Receiver() {
+        return PacketStreamReceiver { &SharedMemoryPacketWriter::Callback, this, &SharedMemoryPacketWriter::BatchCallback };
+    }
+
+    static void Callback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference);
+    static void BatchCallback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference);
+
+protected:
+    bool WaitForSpace(size_t needed);
+    void Publish();
+};
+
+//============================================================================
+// Consumer side of a ring. Packets are delivered through a PacketStreamRouter
+// with pointers directly into shared memory; the space is handed back to the
+// producer after each Poll, so receivers must not keep the pointers.
+class SharedMemoryPacketReader {
+protected:
+    SharedMemoryRing& _Ring;
+    const PacketStreamRouter& _Router;
+    uint64_t _Tail;
+
+public:
+    uint64_t Packets = 0;
+    uint64_t UnknownTypes = 0;
+    uint64_t LengthErrors = 0;
+
+    SharedMemoryPacketReader(SharedMemoryRing& ring, const PacketStreamRouter& router);
+
+    // Deliver up to maxpackets available packets and return how many were
+    // read. Does not block. The ring is shared with another process, so its
+    // head position and record headers are checked before use; if they are
+    // corrupt, the packets before the damage are delivered and Poll throws.
+    // The reader cannot continue after that.
+    size_t Poll(size_t maxpackets = SIZE_MAX);
+
+    // Sleep until packets are available or the timeout expires. Returns true
+    // if packets are available.
+    bool Wait(int timeout_ms);
+
+    // Poll and wait until running becomes false.
+    void Run(const atomic<bool>& running, int timeout_ms = 100);
+};
+
+}
@@ -0,0 +1,257 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+// Per-receiver PacketStream delivery statistics. A receiver opts in by being
+// wrapped in a PacketStreamStatsReceiver, whose entry takes its place in the
+// descriptor's receiver table; PacketStreamReceiver itself is unchanged.
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+#include <seLib/experimental/PacketStream.h>
+
+namespace seLib {
+
+using namespace std;
+
+// Plain copy of a receiver's counters at one point in time.
+struct PacketStreamStatsSnapshot {
+    // Callback durations are bucketed log-linearly: values below 2^SubBucketBits
+    // nanoseconds get one bucket each, and every further power of two is split
+    // into 2^SubBucketBits equal buckets, for a relative error below 1/16.
+    static const int SubBucketBits = 4;
+    static const int SubBucketCount = 1 << SubBucketBits;
+    static const int MaxExponent = 36; // durations are clamped to about 68 s
+    static const int BucketCount = (MaxExponent - SubBucketBits + 1) * SubBucketCount;
+
+    uint64_t Calls = 0;
+    uint64_t Packets = 0;
+    uint64_t Bytes = 0;
+    uint64_t TotalNanoseconds = 0;
+    uint64_t MaxNanoseconds = 0;
+    // Async delivery only: packets dropped by the overflow policy, queue depth
+    // in entries, and the longest time a packet waited in the queue.
+    uint64_t Drops = 0;
+    uint64_t QueueDepth = 0;
+    uint64_t MaxQueueDepth = 0;
+    uint64_t MaxQueueNanoseconds = 0;
+    uint64_t Histogram[BucketCount] = {};
+
+    static inline int Bucket(uint64_t nanoseconds) {
+        if (nanoseconds < (uint64_t)SubBucketCount)
+            return (int)nanoseconds;
+        int exponent = 63 - __builtin_clzll(nanoseconds);
+        if (exponent >= MaxExponent)
+            return BucketCount - 1;
+        int sub = (int)(nanoseconds >> (exponent - SubBucketBits)) & (SubBucketCount - 1);
+        return (exponent - SubBucketBits + 1) * SubBucketCount + sub;
+    }
+
+    // Smallest duration counted in a bucket.
+    static inline uint64_t BucketLowerBound(int bucket) {
+        if (bucket < SubBucketCount)
+            return (uint64_t)bucket;
+        int exponent = bucket / SubBucketCount + SubBucketBits - 1;
+        uint64_t sub = (uint64_t)(bucket % SubBucketCount);
+        return ((uint64_t)1 << exponent) + (sub << (exponent - SubBucketBits));
+    }
+
+    // Approximate callback duration below which the given fraction (0 to 1) of
+    // calls completed.
+    uint64_t Percentile(double fraction) const {
+        uint64_t target = (uint64_t)(fraction * Calls);
+        uint64_t count = 0;
+        for (int i = 0; i < BucketCount; i++) {
+            count += Histogram[i];
+            if (count > target)
+                return BucketLowerBound(i);
+        }
+        return MaxNanoseconds;
+    }
+
+    inline double MeanNanoseconds() const {
+        return (Calls > 0) ? (double)TotalNanoseconds / Calls : 0;
+    }
+};
+
+// Live counters for one receiver. Updates are relaxed atomics, so a receiver
+// may be called from several worker threads.
+class PacketStreamStats {
+protected:
+    atomic<uint64_t> _Calls { 0 };
+    atomic<uint64_t> _Packets { 0 };
+    atomic<uint64_t> _Bytes { 0 };
+    atomic<uint64_t> _TotalNanoseconds { 0 };
+    atomic<uint64_t> _MaxNanoseconds { 0 };
+    atomic<uint64_t> _Drops { 0 };
+    atomic<uint64_t> _QueueDepth { 0 };
+    atomic<uint64_t> _MaxQueueDepth { 0 };
+    atomic<uint64_t> _MaxQueueNanoseconds { 0 };
+    atomic<uint64_t> _Histogram[PacketStreamStatsSnapshot::BucketCount] = {};
+
+    static inline void StoreMax(atomic<uint64_t>& target, uint64_t value) {
+        uint64_t current = target.load(memory_order_relaxed);
+        while (value > current && !target.compare_exchange_weak(current, value, memory_order_relaxed)) { }
+    }
+
+public:
+    typedef chrono::steady_clock Clock;
+
+    // Measures one receiver call from construction to destruction. Does
+    // nothing if stats is null.
+    class Timer {
+    protected:
+        PacketStreamStats* _Stats;
+        size_t _Packets;
+        size_t _Bytes;
+        Clock::time_point _Start;
+
+    public:
+        inline Timer(PacketStreamStats* stats, size_t packets, size_t bytes) :
+            _Stats(stats), _Packets(packets), _Bytes(bytes)
+        {
+            if (_Stats != nullptr)
+                _Start = Clock::now();
+        }
+
+        inline ~Timer() {
+            if (_Stats == nullptr)
+                return;
+            uint64_t elapsed = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - _Start).count();
+            _Stats->RecordCall(_Packets, _Bytes, elapsed);
+        }
+    };
+
+    PacketStreamStats() { }
+    PacketStreamStats(const PacketStreamStats&) = delete;
+    PacketStreamStats& operator=(const PacketStreamStats&) = delete;
+
+    inline void RecordCall(size_t packets, size_t bytes, uint64_t nanoseconds) {
+        _Calls.fetch_add(1, memory_order_relaxed);
+        _Packets.fetch_add(packets, memory_order_relaxed);
+        _Bytes.fetch_add(bytes, memory_order_relaxed);
+        _TotalNanoseconds.fetch_add(nanoseconds, memory_order_relaxed);
+        _Histogram[PacketStreamStatsSnapshot::Bucket(nanoseconds)].fetch_add(1, memory_order_relaxed);
+        StoreMax(_MaxNanoseconds, nanoseconds);
+    }
+
+    inline void RecordDrops(uint64_t packets) {
+        _Drops.fetch_add(packets, memory_order_relaxed);
+    }
+
+    inline void RecordQueueDepth(uint64_t depth) {
+        _QueueDepth.store(depth, memory_order_relaxed);
+        StoreMax(_MaxQueueDepth, depth);
+    }
+
+    inline void RecordQueueLatency(uint64_t nanoseconds) {
+        StoreMax(_MaxQueueNanoseconds, nanoseconds);
+    }
+
+    PacketStreamStatsSnapshot Snapshot() const {
+        PacketStreamStatsSnapshot snapshot;
+        snapshot.Calls = _Calls.load(memory_order_relaxed);
+        snapshot.Packets = _Packets.load(memory_order_relaxed);
+        snapshot.Bytes = _Bytes.load(memory_order_relaxed);
+        snapshot.TotalNanoseconds = _TotalNanoseconds.load(memory_order_relaxed);
+        snapshot.MaxNanoseconds = _MaxNanoseconds.load(memory_order_relaxed);
+        snapshot.Drops = _Drops.load(memory_order_relaxed);
+        snapshot.QueueDepth = _QueueDepth.load(memory_order_relaxed);
+        snapshot.MaxQueueDepth = _MaxQueueDepth.load(memory_order_relaxed);
+        snapshot.MaxQueueNanoseconds = _MaxQueueNanoseconds.load(memory_order_relaxed);
+        for (int i = 0; i < PacketStreamStatsSnapshot::BucketCount; i++)
+            snapshot.Histogram[i] = _Histogram[i].load(memory_order_relaxed);
+        return snapshot;
+    }
+
+    void Reset() {
+        _Calls = 0;
+        _Packets = 0;
+        _Bytes = 0;
+        _TotalNanoseconds = 0;
+        _MaxNanoseconds = 0;
+        _Drops = 0;
+        _QueueDepth = 0;
+        _MaxQueueDepth = 0;
+        _MaxQueueNanoseconds = 0;
+        for (auto& bucket : _Histogram)
+            bucket = 0;
+    }
+};
+
+//============================================================================
+// Receiver entry that times every call to another receiver into a
+// PacketStreamStats. An AsyncPacketStream recognises the wrapper, calls the
+// wrapped receiver itself and also records drops, queue depth and queue
+// latency. The wrapper must outlive every table its entry is placed in.
+class PacketStreamStatsReceiver {
+protected:
+    PacketStreamReceiver _Inner;
+    PacketStreamStats& _Stats;
+
+public:
+    PacketStreamStatsReceiver(PacketStreamReceiver inner, PacketStreamStats& stats) :
+        _Inner(inner), _Stats(stats)
+    { }
+
+    PacketStreamStatsReceiver(const PacketStreamStatsReceiver&) = delete;
+    PacketStreamStatsReceiver& operator=(const PacketStreamStatsReceiver&) = delete;
+
+    inline PacketStreamReceiver Receiver() const {
+        return PacketStreamReceiver { &Callback, (void*)this, &BatchCallback };
+    }
+
+    inline const PacketStreamReceiver& Inner() const {
+        return _Inner;
+    }
+
+    inline PacketStreamStats& Stats() const {
+        return _Stats;
+    }
+
+    // The wrapper behind a receiver entry, or null if it is not one.
+    static inline const PacketStreamStatsReceiver* From(const PacketStreamReceiver& receiver) {
+        if (receiver.batchcallback != &BatchCallback)
+            return nullptr;
+        return (const PacketStreamStatsReceiver*)receiver.reference;
+    }
+
+    static void Callback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference) {
+        const PacketStreamStatsReceiver& self = *(const PacketStreamStatsReceiver*)reference;
+        const PacketStreamReceiver& t = self._Inner;
+        PacketStreamStats::Timer timer(&self._Stats, 1, descriptor.PacketSize);
+        if (t.callback != nullptr)
+            t.callback(descriptor, packetdata, t.reference);
+        else
+            t.batchcallback(descriptor, packetdata, 1, t.reference);
+    }
+
+    static void BatchCallback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference) {
+        const PacketStreamStatsReceiver& self = *(const PacketStreamStatsReceiver*)reference;
+        const PacketStreamReceiver& t = self._Inner;
+        PacketStreamStats::Timer timer(&self._Stats, packetcount, packetcount * descriptor.PacketSize);
+        if (t.batchcallback != nullptr) {
+            t.batchcallback(descriptor, packetdata, packetcount, t.reference);
+            return;
+        }
+        for (size_t n = 0; n < packetcount; n++, packetdata += descriptor.PacketSize)
+            t.callback(descriptor, packetdata, t.reference);
+    }
+};
+
+}
@@ -0,0 +1,110 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <exception>
+
+#include <seLib/FixedPoint.h>
+#include <seLib/RefObj.h>
+
+namespace seLib {
+namespace Serializable {
+
+using namespace std;
+
+// Compression for arrays of correlated integer samples. Each sample is
+// replaced by its difference from the previous one (modulo 2^32), the
+// difference is zigzag encoded so small negative steps stay small, and the
+// result is stored in 1 to 4 bytes, group-varint style: a control byte holds
+// the byte counts of four samples, and the data bytes of all samples follow
+// the control bytes. Decoding expands four samples per control byte with
+// one SSSE3 shuffle and undoes the deltas with a vector prefix sum; the
+// SSSE3 path is chosen at run time on x86, so no -mssse3 is needed.
+//
+// A frame starts with a SampleFrameHeader; all fields are little endian.
+// Supported sample types are int16_t, uint16_t, int32_t and uint32_t, and
+// FixedPoint values with those storage types.
+
+struct SampleFrameHeader {
+    uint8_t Magic[2];     // 'S', 'Z'
+    uint8_t Version;
+    uint8_t SampleType;   // SampleTypeOf<T>::Value
+    uint8_t Count[4];     // samples
+    uint8_t DataBytes[4]; // bytes after the control bytes
+};
+
+template <typename T> struct SampleTypeOf;
+template <> struct SampleTypeOf<int16_t> { static const uint8_t Value = 1; };
+template <> struct SampleTypeOf<uint16_t> { static const uint8_t Value = 2; };
+template <> struct SampleTypeOf<int32_t> { static const uint8_t Value = 3; };
+template <> struct SampleTypeOf<uint32_t> { static const uint8_t Value = 4; };
+
+// Largest frame count samples can need.
+inline size_t SampleFrameMaxSize(size_t count) {
+    return sizeof(SampleFrameHeader) + (count + 3) / 4 + count * 4;
+}
+
+// Encode count samples into out, which must hold SampleFrameMaxSize(count)
+// bytes. Returns the frame size.
+template <typename T>
+size_t EncodeSamples(const T* in, size_t count, uint8_t* out);
+
+// Number of samples in a frame. Throws if it is not a frame of T or if len
+// is too short to hold that many samples.
+template <typename T>
+size_t SampleFrameCount(const uint8_t* in, size_t len);
+
+// Decode a frame of len bytes into out, which must hold
+// SampleFrameCount<T>(in, len) samples. Returns the sample count. Throws if
+// the frame is not a valid frame of T.
+template <typename T>
+size_t DecodeSamples(const uint8_t* in, size_t len, T* out);
+
+// FixedPoint arrays are coded as their raw storage values.
+template <int magnitude, bool safe_checks, typename Storage_T, typename Math_T>
+inline size_t EncodeSamples(const FixedPoint<magnitude, safe_checks, Storage_T, Math_T>* in, size_t count, uint8_t* out) {
+    static_assert(sizeof(FixedPoint<magnitude, safe_checks, Storage_T, Math_T>) == sizeof(Storage_T), "FixedPoint must be its storage");
+    return EncodeSamples((const Storage_T*)in, count, out);
+}
+
+template <int magnitude, bool safe_checks, typename Storage_T, typename Math_T>
+inline size_t DecodeSamples(const uint8_t* in, size_t len, FixedPoint<magnitude, safe_checks, Storage_T, Math_T>* out) {
+    static_assert(sizeof(FixedPoint<magnitude, safe_checks, Storage_T, Math_T>) == sizeof(Storage_T), "FixedPoint must be its storage");
+    return DecodeSamples(in, len, (Storage_T*)out);
+}
+
+// Encode into a new buffer of SampleFrameMaxSize(count) bytes. The returned
+// view covers only the frame.
+template <typename T>
+inline RefBufferView EncodeSamples(const T* in, size_t count) {
+    RefBuffer* buffer = new ManagedRefBuffer(SampleFrameMaxSize(count));
+    size_t len = EncodeSamples(in, count, **buffer);
+    return RefBufferView(buffer, 0, len);
+}
+
+// Decode a frame into a new buffer of samples.
+template <typename T>
+inline RefBufferView DecodeSamples(const BufferView& frame) {
+    size_t count = SampleFrameCount<T>(*frame, frame.size());
+    RefBufferView samples(count * sizeof(T));
+    DecodeSamples(*frame, frame.size(), (T*)*samples);
+    return samples;
+}
+
+}
+}
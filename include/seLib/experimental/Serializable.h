@@ -16,7 +16,9 @@
 */
 
 #include <stdint.h>
-#include <strings.h>
+#include <string.h>
+
+#include <seLib/experimental/ByteOrder.h>
 
 
 namespace seLib {
@@ -27,57 +29,93 @@ namespace Serializable {
 // potential alignement issues, but may create temporary copies in the process.
 template <typename T>
 struct SerializedType final {
+    // Storage, so an array of these lays values out back to back.
+    uint8_t Bytes[sizeof(T)];
+
     inline T operator*() const {
         T value;
-        memcpy(&value, this, sizeof(T));
+        memcpy(&value, Bytes, sizeof(T));
         return value;
     }
 
     inline SerializedType<T>& Set(const T& value) {
-        memcpy(this, &value, sizeof(T));
+        memcpy(Bytes, &value, sizeof(T));
         return *this;
     }
 };
 
-// todo: not ready yet
+// Integer or floating point value stored least significant byte first,
+// whatever the host's byte order. Like SerializedType, it may sit at any
+// alignment in a buffer.
 template <typename T>
 struct SerializedLittleEndian final {
-    inline const T& operator*() const {
-        T value = 0;
-        for (int i = 0; i < sizeof(T); i++) {
-            int byteposition = i;
-            value |= (T)(((uint8_t*)this)[byteposition]) << (8 * i);
-        }
-        return *(T*)this;
+    typedef typename UnsignedOfSize<sizeof(T)>::type Unsigned_t;
+
+    uint8_t Bytes[sizeof(T)];
+
+    inline T operator*() const {
+        Unsigned_t bits = 0;
+        for (size_t i = 0; i < sizeof(T); i++)
+            bits |= (Unsigned_t)Bytes[i] << (8 * i);
+        T value;
+        memcpy(&value, &bits, sizeof(T));
+        return value;
     }
+
     inline SerializedLittleEndian<T>& Set(const T& value) {
-        for (int i = 0; i < sizeof(T); i++) {
-            int byteposition = i;
-            ((uint8_t*)this)[byteposition] = (uint8_t)((value >> (8 * i)) & 0xFFu);
-        }
+        Unsigned_t bits;
+        memcpy(&bits, &value, sizeof(T));
+        for (size_t i = 0; i < sizeof(T); i++)
+            Bytes[i] = (uint8_t)(bits >> (8 * i));
         return *this;
     }
 };
 
-// todo: not ready yet
+// Integer or floating point value stored most significant byte first.
 template <typename T>
 struct SerializedBigEndian final {
-    inline const T& operator*() const {
-        T value = 0;
-        for (int i = 0; i < sizeof(T); i++) {
-            int byteposition = sizeof(T) - i;
-            value |= (T)(((uint8_t*)this)[byteposition]) << (8 * i);
-        }
-        return *(T*)this;
+    typedef typename UnsignedOfSize<sizeof(T)>::type Unsigned_t;
+
+    uint8_t Bytes[sizeof(T)];
+
+    inline T operator*() const {
+        Unsigned_t bits = 0;
+        for (size_t i = 0; i < sizeof(T); i++)
+            bits |= (Unsigned_t)Bytes[sizeof(T) - 1 - i] << (8 * i);
+        T value;
+        memcpy(&value, &bits, sizeof(T));
+        return value;
     }
-    inline SerializedLittleEndian<T>& Set(const T& value) {
-        for (int i = 0; i < sizeof(T); i++) {
-            int byteposition = sizeof(T) - i;
-            ((uint8_t*)this)[byteposition] = (uint8_t)((value >> (8 * i)) & 0xFFu);
-        }
+
+    inline SerializedBigEndian<T>& Set(const T& value) {
+        Unsigned_t bits;
+        memcpy(&bits, &value, sizeof(T));
+        for (size_t i = 0; i < sizeof(T); i++)
+            Bytes[sizeof(T) - 1 - i] = (uint8_t)(bits >> (8 * i));
         return *this;
     }
 };
 
+// Whole arrays of serialized values, converted with ByteSwapArray.
+template <typename T>
+inline void Load(T* out, const SerializedBigEndian<T>* in, size_t count) {
+    FromBigEndian(out, in, count);
+}
+
+template <typename T>
+inline void Load(T* out, const SerializedLittleEndian<T>* in, size_t count) {
+    FromLittleEndian(out, in, count);
+}
+
+template <typename T>
+inline void Store(SerializedBigEndian<T>* out, const T* in, size_t count) {
+    ToBigEndian(out, in, count);
+}
+
+template <typename T>
+inline void Store(SerializedLittleEndian<T>* out, const T* in, size_t count) {
+    ToLittleEndian(out, in, count);
+}
+
 }
 }
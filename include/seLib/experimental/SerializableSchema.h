@@ -0,0 +1,241 @@
+#pragma once
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <exception>
+#include <type_traits>
+#include <vector>
+
+#include <seLib/RefObj.h>
+#include <seLib/experimental/ByteOrder.h>
+
+namespace seLib {
+namespace Serializable {
+
+using namespace std;
+
+// Packed wire records described at compile time. Each field is a type
+// naming its value type and byte order:
+//
+//     SerializedField(Id, uint16_t, Big);
+//     SerializedField(Time, uint32_t, Big);
+//     SerializedField(Value, float, Big);
+//     typedef Schema<Id, Time, Value> Sample_t;
+//     static_assert(Sample_t::Size == 10 && Sample_t::Offset<Value>() == 6, "wire layout");
+//
+//     RecordView<Sample_t> sample(buffer);
+//     float value = sample.Get<Value>();
+//
+// Offsets are constants, so Get is one unaligned load plus a byte swap when
+// the field's order is not the host's.
+
+template <typename T, ByteOrder Order = ByteOrder::Native>
+struct Field {
+    typedef T Type;
+    static constexpr ByteOrder FieldOrder = Order;
+    static constexpr size_t Size = sizeof(T);
+
+    static_assert(is_arithmetic<T>::value, "a field must be an integer or floating point type");
+    static_assert(Size == 1 || Size == 2 || Size == 4 || Size == 8, "a field must be 1, 2, 4 or 8 bytes");
+
+    static inline T Read(const uint8_t* data) {
+        T value;
+        memcpy(&value, data, sizeof(T));
+        if (Order != ByteOrder::Native)
+            ByteSwapArray<sizeof(T)>(&value, &value, 1);
+        return value;
+    }
+
+    static inline void Write(uint8_t* data, T value) {
+        if (Order != ByteOrder::Native)
+            ByteSwapArray<sizeof(T)>(&value, &value, 1);
+        memcpy(data, &value, sizeof(T));
+    }
+};
+
+// Declare a field type called Name, in Little, Big or Native order.
+#define SerializedField(Name, Type, Order) \
+    struct Name : seLib::Serializable::Field<Type, seLib::Serializable::ByteOrder::Order> { \
+        static constexpr const char* FieldName = #Name; \
+    }
+
+template <typename... Fields>
+struct Schema {
+    static_assert(sizeof...(Fields) > 0, "a schema needs at least one field");
+
+    static constexpr size_t Count = sizeof...(Fields);
+    static constexpr size_t Size = (Fields::Size + ...);
+    static constexpr size_t Sizes[] = { Fields::Size... };
+    static constexpr const char* Names[] = { Fields::FieldName... };
+
+    template <typename F>
+    static constexpr size_t Index() {
+        constexpr bool matches[] = { is_same<F, Fields>::value... };
+        size_t index = Count;
+        size_t found = 0;
+        for (size_t i = 0; i < Count; i++) {
+            if (matches[i]) {
+                index = i;
+                found++;
+            }
+        }
+        return (found == 1) ? index : Count;
+    }
+
+    template <typename F>
+    static constexpr size_t Offset() {
+        static_assert(Index<F>() < Count, "the field is not in this schema, or is in it twice");
+        size_t offset = 0;
+        for (size_t i = 0; i < Index<F>(); i++)
+            offset += Sizes[i];
+        return offset;
+    }
+
+    static constexpr size_t Offset(size_t index) {
+        size_t offset = 0;
+        for (size_t i = 0; i < index; i++)
+            offset += Sizes[i];
+        return offset;
+    }
+
+    template <typename F>
+    static inline typename F::Type Get(const uint8_t* record) {
+        constexpr size_t offset = Offset<F>();
+        return F::Read(record + offset);
+    }
+
+    template <typename F>
+    static inline void Set(uint8_t* record, typename F::Type value) {
+        constexpr size_t offset = Offset<F>();
+        F::Write(record + offset, value);
+    }
+};
+
+//============================================================================
+// One record at the start of a buffer or view. Does not own the memory.
+template <typename Schema_T>
+class RecordView {
+protected:
+    uint8_t* _Data;
+
+public:
+    typedef Schema_T Schema_t;
+
+    RecordView(uint8_t* data) : _Data(data) { }
+
+    RecordView(const BufferView& view, size_t offset = 0) : _Data(*view + offset) {
+        if (offset + Schema_T::Size > view.size())
+            throw exception();
+    }
+
+    inline uint8_t* data() const {
+        return _Data;
+    }
+
+    static constexpr size_t size() {
+        return Schema_T::Size;
+    }
+
+    template <typename F>
+    inline typename F::Type Get() const {
+        return Schema_T::template Get<F>(_Data);
+    }
+
+    template <typename F>
+    inline void Set(typename F::Type value) const {
+        Schema_T::template Set<F>(_Data, value);
+    }
+};
+
+// A RecordView that holds a reference to its RefBuffer, keeping the record
+// alive as long as the view.
+template <typename Schema_T>
+class RefRecordView : public RecordView<Schema_T> {
+protected:
+    RefBufferView _View;
+
+public:
+    RefRecordView(const RefBufferView& view, size_t offset = 0) :
+        RecordView<Schema_T>(view, offset), _View(view)
+    { }
+};
+
+//============================================================================
+// Records laid out back to back, such as the payload of a packet. Extract
+// copies one field of every record into a plain array (array of structures
+// to structure of arrays), swapping the byte order of the whole column at
+// once.
+template <typename Schema_T>
+class RecordArrayView {
+protected:
+    uint8_t* _Data;
+    size_t _Count;
+
+public:
+    typedef Schema_T Schema_t;
+
+    RecordArrayView(uint8_t* data, size_t count) : _Data(data), _Count(count) { }
+
+    // All whole records in the view, from offset.
+    RecordArrayView(const BufferView& view, size_t offset = 0) : _Data(*view + offset), _Count(0) {
+        if (offset > view.size())
+            throw exception();
+        _Count = (view.size() - offset) / Schema_T::Size;
+    }
+
+    inline size_t size() const {
+        return _Count;
+    }
+
+    inline uint8_t* data() const {
+        return _Data;
+    }
+
+    inline RecordView<Schema_T> operator[](size_t index) const {
+        return RecordView<Schema_T>(_Data + index * Schema_T::Size);
+    }
+
+    template <typename F>
+    void Extract(typename F::Type* out) const {
+        typedef typename F::Type T;
+        constexpr size_t offset = Schema_T::template Offset<F>();
+        const uint8_t* field = _Data + offset;
+        for (size_t i = 0; i < _Count; i++)
+            memcpy(out + i, field + i * Schema_T::Size, sizeof(T));
+        ConvertArray<F::FieldOrder, T>(out, out, _Count);
+    }
+
+    template <typename F>
+    void Extract(vector<typename F::Type>& out) const {
+        out.resize(_Count);
+        Extract<F>(out.data());
+    }
+
+    // The reverse of Extract: store in[i] into field F of record i.
+    template <typename F>
+    void Insert(const typename F::Type* in) const {
+        constexpr size_t offset = Schema_T::template Offset<F>();
+        uint8_t* field = _Data + offset;
+        for (size_t i = 0; i < _Count; i++)
+            F::Write(field + i * Schema_T::Size, in[i]);
+    }
+};
+
+}
+}
@@ -0,0 +1,240 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <math.h>
+#include <string.h>
+#include <exception>
+#include <type_traits>
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <seLib/experimental/BitPacking.h>
+
+namespace seLib {
+namespace Serializable {
+
+using namespace std;
+
+template <typename T>
+static inline void CheckWidth(unsigned int bits) {
+    if (bits == 0 || bits > sizeof(T) * 8)
+        throw exception();
+}
+
+static inline uint32_t WidthMask(unsigned int bits) {
+    return (bits >= 32) ? 0xFFFFFFFFu : ((1u << bits) - 1);
+}
+
+//== Pack ========================================================================
+
+// Packs samples from index i on with a bit accumulator; out is the start of
+// the packed buffer.
+template <typename T>
+static void PackScalar(const T* in, size_t i, size_t count, unsigned int bits, uint8_t* out) {
+    uint32_t mask = WidthMask(bits);
+    // i is always a multiple of 8, so sample i starts on a byte.
+    uint8_t* p = out + i * bits / 8;
+    uint64_t accumulator = 0;
+    unsigned int filled = 0;
+    for (; i < count; i++) {
+        accumulator |= (uint64_t)((uint32_t)in[i] & mask) << filled;
+        filled += bits;
+        while (filled >= 8) {
+            *p++ = (uint8_t)accumulator;
+            accumulator >>= 8;
+            filled -= 8;
+        }
+    }
+    if (filled > 0)
+        *p = (uint8_t)accumulator;
+}
+
+template <typename T>
+static void Pack(const T* in, size_t count, unsigned int bits, uint8_t* out) {
+    CheckWidth<T>(bits);
+    size_t i = 0;
+
+#if defined(__SSSE3__)
+    size_t size = PackedSampleSize(bits, count);
+    // Low three bytes of each 32-bit lane, written 16 bytes at a time while
+    // the 4 spare bytes stay inside the buffer.
+    const __m128i three = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    if (bits == 24 && sizeof(T) == 4) {
+        for (; i + 4 <= count && i * 3 + 16 <= size; i += 4) {
+            __m128i samples = _mm_loadu_si128((const __m128i*)(in + i));
+            _mm_storeu_si128((__m128i*)(out + i * 3), _mm_shuffle_epi8(samples, three));
+        }
+    } else if (bits == 12 && sizeof(T) == 2) {
+        // Join pairs of 12-bit samples into 24 bits with one multiply-add,
+        // then pack those like 24-bit samples.
+        const __m128i mask = _mm_set1_epi16(0x0FFF);
+        const __m128i join = _mm_set1_epi32(0x10000001);
+        for (; i + 8 <= count && i * 3 / 2 + 16 <= size; i += 8) {
+            __m128i samples = _mm_and_si128(_mm_loadu_si128((const __m128i*)(in + i)), mask);
+            __m128i pairs = _mm_madd_epi16(samples, join);
+            _mm_storeu_si128((__m128i*)(out + i * 3 / 2), _mm_shuffle_epi8(pairs, three));
+        }
+    }
+#endif
+
+    PackScalar(in, i, count, bits, out);
+}
+
+void PackSamples(const int16_t* in, size_t count, unsigned int bits, uint8_t* out) {
+    Pack(in, count, bits, out);
+}
+
+void PackSamples(const uint16_t* in, size_t count, unsigned int bits, uint8_t* out) {
+    Pack(in, count, bits, out);
+}
+
+void PackSamples(const int32_t* in, size_t count, unsigned int bits, uint8_t* out) {
+    Pack(in, count, bits, out);
+}
+
+void PackSamples(const uint32_t* in, size_t count, unsigned int bits, uint8_t* out) {
+    Pack(in, count, bits, out);
+}
+
+void PackSamples(const float* in, size_t count, unsigned int bits, float scale, uint8_t* out) {
+    CheckWidth<int32_t>(bits);
+    double high = (double)(WidthMask(bits) >> 1);
+    double low = -high - 1;
+    int32_t chunk[1024];
+    size_t done = 0;
+    while (done < count) {
+        // Chunks of a multiple of 8 samples end on a byte boundary.
+        size_t n = (count - done < 1024) ? count - done : 1024;
+        for (size_t i = 0; i < n; i++) {
+            double value = nearbyint((double)in[done + i] / scale);
+            chunk[i] = (int32_t)((value > high) ? high : (value < low || value != value) ? low : value);
+        }
+        Pack(chunk, n, bits, out + done * bits / 8);
+        done += n;
+    }
+}
+
+//== Unpack ========================================================================
+
+template <typename T>
+static void UnpackScalar(const uint8_t* in, size_t i, size_t count, unsigned int bits, T* out) {
+    uint32_t mask = WidthMask(bits);
+    unsigned int extend = 32 - bits;
+    const uint8_t* p = in + i * bits / 8;
+    uint64_t accumulator = 0;
+    unsigned int filled = 0;
+    for (; i < count; i++) {
+        while (filled < bits) {
+            accumulator |= (uint64_t)*p++ << filled;
+            filled += 8;
+        }
+        uint32_t value = (uint32_t)accumulator & mask;
+        accumulator >>= bits;
+        filled -= bits;
+        if (is_signed<T>::value)
+            out[i] = (T)((int32_t)(value << extend) >> extend);
+        else
+            out[i] = (T)value;
+    }
+}
+
+template <typename T>
+static void Unpack(const uint8_t* in, size_t count, unsigned int bits, T* out) {
+    CheckWidth<T>(bits);
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    if (bits <= 25) {
+        // Eight samples take exactly bits bytes, so every block of eight has
+        // the same layout: sample j starts at byte j * bits / 8, bit
+        // j * bits % 8. Each half of the block is gathered from one 16-byte
+        // load, four bytes per sample, and shifted into place.
+        uint8_t order[2][16];
+        uint32_t shift[2][4];
+        size_t second = 4 * bits / 8;
+        for (unsigned int j = 0; j < 8; j++) {
+            size_t start = j * bits / 8 - ((j < 4) ? 0 : second);
+            for (unsigned int b = 0; b < 4; b++)
+                order[j / 4][(j % 4) * 4 + b] = (uint8_t)(start + b);
+            shift[j / 4][j % 4] = j * bits % 8;
+        }
+        const __m128i order0 = _mm_loadu_si128((const __m128i*)order[0]);
+        const __m128i order1 = _mm_loadu_si128((const __m128i*)order[1]);
+        const __m128i shift0 = _mm_loadu_si128((const __m128i*)shift[0]);
+        const __m128i shift1 = _mm_loadu_si128((const __m128i*)shift[1]);
+        const __m128i mask = _mm_set1_epi32((int)WidthMask(bits));
+        const __m128i extend = _mm_cvtsi32_si128(32 - (int)bits);
+        size_t size = PackedSampleSize(bits, count);
+
+        auto decode = [&](__m128i bytes, __m128i order, __m128i shift) {
+            __m128i values = _mm_srlv_epi32(_mm_shuffle_epi8(bytes, order), shift);
+            if (is_signed<T>::value)
+                return _mm_sra_epi32(_mm_sll_epi32(values, extend), extend);
+            return _mm_and_si128(values, mask);
+        };
+
+        for (; i + 8 <= count && i / 8 * bits + second + 16 <= size; i += 8) {
+            const uint8_t* block = in + i / 8 * bits;
+            __m128i low = decode(_mm_loadu_si128((const __m128i*)block), order0, shift0);
+            __m128i high = decode(_mm_loadu_si128((const __m128i*)(block + second)), order1, shift1);
+            if (sizeof(T) == 4) {
+                _mm_storeu_si128((__m128i*)(out + i), low);
+                _mm_storeu_si128((__m128i*)(out + i + 4), high);
+            } else if (is_signed<T>::value) {
+                _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(low, high));
+            } else {
+                _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi32(low, high));
+            }
+        }
+    }
+#endif
+
+    UnpackScalar(in, i, count, bits, out);
+}
+
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, int16_t* out) {
+    Unpack(in, count, bits, out);
+}
+
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, uint16_t* out) {
+    Unpack(in, count, bits, out);
+}
+
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, int32_t* out) {
+    Unpack(in, count, bits, out);
+}
+
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, uint32_t* out) {
+    Unpack(in, count, bits, out);
+}
+
+void UnpackSamples(const uint8_t* in, size_t count, unsigned int bits, float scale, float* out) {
+    CheckWidth<int32_t>(bits);
+    int32_t chunk[1024];
+    size_t done = 0;
+    while (done < count) {
+        size_t n = (count - done < 1024) ? count - done : 1024;
+        Unpack(in + done * bits / 8, n, bits, chunk);
+        for (size_t i = 0; i < n; i++)
+            out[done + i] = (float)chunk[i] * scale;
+        done += n;
+    }
+}
+
+}
+}
@@ -0,0 +1,331 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <limits>
+
+#include <seLib/experimental/CSVColumns.h>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+void CSVColumnExtractor::Add(unsigned int column, const string& name, CSVColumnType type, void* out) {
+  _Targets.push_back(Target { column, name, type, out, SIZE_MAX, -1 });
+}
+
+void CSVColumnExtractor::Resolve(const vector<string_view>& header) {
+  for (auto& target : _Targets) {
+    if (target.Name.empty())
+      continue;
+    size_t i = 0;
+    while (i < header.size() && header[i] != target.Name)
+      i++;
+    if (i == header.size())
+      throw exception();
+    target.Column = (unsigned int)i;
+  }
+}
+
+template <typename T>
+static T Parse(string_view cell, CSVColumnError::Kind_t& kind, bool& ok) {
+  const char* p = cell.data();
+  const char* end = p + cell.size();
+  T value = 0;
+  ok = false;
+
+  if (p == end) {
+    kind = CSVColumnError::Missing;
+    return value;
+  }
+  // from_chars does not accept a leading plus sign.
+  if (*p == '+' && end - p > 1 && *(p + 1) != '-')
+    p++;
+  auto result = from_chars(p, end, value);
+  if (result.ec == errc::result_out_of_range) {
+    kind = CSVColumnError::OutOfRange;
+    return 0;
+  }
+  if (result.ec != errc() || result.ptr != end) {
+    kind = CSVColumnError::Invalid;
+    return 0;
+  }
+  ok = true;
+  return value;
+}
+
+template <typename T>
+static void StoreValue(void* out, string_view cell, CSVColumnError::Kind_t& kind, bool& ok) {
+  T value = Parse<T>(cell, kind, ok);
+  if (!ok && numeric_limits<T>::has_quiet_NaN)
+    value = numeric_limits<T>::quiet_NaN();
+  ((vector<T>*)out)->push_back(value);
+}
+
+void CSVColumnExtractor::Store(Target& target, string_view cell, size_t row) {
+  CSVColumnError::Kind_t kind = CSVColumnError::Invalid;
+  bool ok;
+  switch (target.Type) {
+  case CSVColumnType::Float:
+    StoreValue<float>(target.Out, cell, kind, ok);
+    break;
+  case CSVColumnType::Double:
+    StoreValue<double>(target.Out, cell, kind, ok);
+    break;
+  case CSVColumnType::Int32:
+    StoreValue<int32_t>(target.Out, cell, kind, ok);
+    break;
+  default:
+    StoreValue<int64_t>(target.Out, cell, kind, ok);
+    break;
+  }
+  target.LastRow = row;
+  if (!ok)
+    Errors.push_back(CSVColumnError { row, target.Column, kind });
+}
+
+void CSVColumnExtractor::StoreColumn(unsigned int column, string_view cell, size_t row) {
+  for (int i = _ByColumn[column]; i >= 0; i = _Targets[i].Next)
+    Store(_Targets[i], cell, row);
+}
+
+// Fill selected columns the row did not reach.
+void CSVColumnExtractor::FinishRow(size_t row) {
+  for (auto& target : _Targets) {
+    if (target.LastRow != row)
+      Store(target, string_view(), row);
+  }
+}
+
+//== Sidecar ========================================================================
+
+template <typename T, typename S>
+static void Append(vector<T>& out, const S* values, size_t count) {
+  size_t base = out.size();
+  out.resize(base + count);
+  for (size_t i = 0; i < count; i++)
+    out[base + i] = (T)values[i];
+}
+
+void CSVColumnExtractor::Fill(Target& target, const CSVSidecar& sidecar, size_t first) {
+  size_t rows = sidecar.Rows();
+  const int64_t* ints = (target.Column < sidecar.ColumnCount()) ? sidecar.Int64s(target.Column) : nullptr;
+  const double* doubles = (target.Column < sidecar.ColumnCount()) ? sidecar.Doubles(target.Column) : nullptr;
+
+  if (ints == nullptr && doubles == nullptr) {
+    // Not in any row: every value is missing.
+    for (size_t i = 0; i < rows; i++)
+      Store(target, string_view(), first + i);
+    return;
+  }
+
+  switch (target.Type) {
+  case CSVColumnType::Float:
+    if (ints != nullptr)
+      Append(*(vector<float>*)target.Out, ints, rows);
+    else
+      Append(*(vector<float>*)target.Out, doubles, rows);
+    break;
+  case CSVColumnType::Double:
+    if (ints != nullptr)
+      Append(*(vector<double>*)target.Out, ints, rows);
+    else
+      Append(*(vector<double>*)target.Out, doubles, rows);
+    break;
+  case CSVColumnType::Int32: {
+    vector<int32_t>& out = *(vector<int32_t>*)target.Out;
+    for (size_t i = 0; i < rows; i++) {
+      int64_t value = ints[i];
+      if (value < INT32_MIN || value > INT32_MAX) {
+        Errors.push_back(CSVColumnError { first + i, target.Column, CSVColumnError::OutOfRange });
+        value = 0;
+      }
+      out.push_back((int32_t)value);
+    }
+    break;
+  }
+  default:
+    Append(*(vector<int64_t>*)target.Out, ints, rows);
+    break;
+  }
+
+  if (sidecar.HasMissing(target.Column)) {
+    for (size_t i = 0; i < rows; i++) {
+      if (sidecar.IsMissing(target.Column, i))
+        Errors.push_back(CSVColumnError { first + i, target.Column, CSVColumnError::Missing });
+    }
+  }
+}
+
+bool CSVColumnExtractor::ReadSidecar(CSVReader& reader) {
+  if (!reader.mapped || reader.mapPosition != 0 || reader.FileName.empty())
+    return false;
+
+  string path = CSVSidecar::PathFor(reader.FileName);
+  if (!CSVSidecar::IsCurrent(reader.FileName, path)) {
+    if (!CreateSidecar)
+      return false;
+    CSVSidecarOptions options;
+    options.Separator = reader.Separator;
+    options.ParseQuotes = reader.ParseQuotes;
+    options.HeaderRow = HeaderRow;
+    CSVSidecar::Convert(reader.FileName, path, options);
+  }
+
+  CSVSidecar sidecar;
+  sidecar.Open(path);
+  const CSVSidecarHeader& header = sidecar.Header();
+  if (header.Separator != reader.Separator || (header.ParseQuotes != 0) != reader.ParseQuotes ||
+    (header.HeaderRow != 0) != HeaderRow)
+    return false;
+
+  if (HeaderRow) {
+    vector<string_view> names;
+    for (size_t c = 0; c < sidecar.ColumnCount(); c++)
+      names.push_back(sidecar.Name(c));
+    Resolve(names);
+  }
+
+  // Text columns are not stored, a Double column cannot give the integers a
+  // parse would, and only some give the same floats: read those from the CSV.
+  for (auto& target : _Targets) {
+    if (target.Column >= sidecar.ColumnCount())
+      continue;
+    CSVSidecarType type = sidecar.Type(target.Column);
+    if (type == CSVSidecarType::Text)
+      return false;
+    if (type == CSVSidecarType::Double && (target.Type == CSVColumnType::Int32 || target.Type == CSVColumnType::Int64))
+      return false;
+    if (target.Type == CSVColumnType::Float && !sidecar.FloatExact(target.Column))
+      return false;
+  }
+
+  size_t first = Rows;
+  size_t firstError = Errors.size();
+  for (auto& target : _Targets)
+    Fill(target, sidecar, first);
+  Rows += sidecar.Rows();
+  // Report errors in row order, as a parse would.
+  stable_sort(Errors.begin() + firstError, Errors.end(), [](const CSVColumnError& a, const CSVColumnError& b) {
+    return a.Row < b.Row;
+  });
+
+  reader.mapPosition = reader.mapSize;
+  reader.cursorReady = false;
+  return true;
+}
+
+//== Read ========================================================================
+
+size_t CSVColumnExtractor::Read(CSVReader& reader) {
+  for (auto& target : _Targets) {
+    if (!target.Name.empty() && !HeaderRow)
+      throw exception();
+  }
+
+  size_t first = Rows;
+  if (UseSidecar && ReadSidecar(reader))
+    return Rows - first;
+
+  if (HeaderRow && reader.ReadRow())
+    Resolve(reader.cells);
+
+  unsigned int columns = 0;
+  for (auto& target : _Targets) {
+    if (target.Column + 1 > columns)
+      columns = target.Column + 1;
+  }
+  _ByColumn.assign(columns, -1);
+  for (size_t i = _Targets.size(); i-- > 0; ) {
+    _Targets[i].Next = _ByColumn[_Targets[i].Column];
+    _ByColumn[_Targets[i].Column] = (int)i;
+  }
+
+  if (!reader.mapped || !reader.UseStructuralIndex) {
+    while (reader.ReadRow(columns)) {
+      if (reader.cells.empty())
+        continue;
+      for (size_t c = 0; c < reader.cells.size() && c < columns; c++) {
+        if (_ByColumn[c] >= 0)
+          StoreColumn((unsigned int)c, reader.cells[c], Rows);
+      }
+      FinishRow(Rows);
+      Rows++;
+    }
+    return Rows - first;
+  }
+
+  // Walk the structural positions directly: a cell is only trimmed and
+  // parsed if its column is selected.
+  CSVStructuralCursor& cursor = reader.cursor;
+  if (!reader.cursorReady) {
+    cursor.Reset(reader.mapData, reader.mapSize, reader.mapPosition, reader.Separator, reader.ParseQuotes);
+    reader.cursorReady = true;
+  }
+  const char* data = reader.mapData;
+  size_t size = reader.mapSize;
+
+  while (reader.mapPosition < size) {
+    const char* start = data + reader.mapPosition;
+    unsigned int column = 0;
+    size_t next;
+    bool ended = false;
+
+    while (cursor.Next(next)) {
+      const char* stop = data + next;
+      bool newline = (*stop == '\n');
+      if (newline && stop > start && *(stop - 1) == '\r')
+        stop--;
+      if (newline && column == 0 && stop == start) {
+        // Empty line: not a data row.
+        column = UINT32_MAX;
+      } else if (column < columns && _ByColumn[column] >= 0) {
+        StoreColumn(column, reader.Cell(start, stop), Rows);
+      }
+      if (newline) {
+        reader.mapPosition = next + 1;
+        ended = true;
+        break;
+      }
+      column++;
+      start = data + next + 1;
+    }
+
+    if (!ended) {
+      const char* stop = data + size;
+      if (stop > start && *(stop - 1) == '\r')
+        stop--;
+      if (column == 0 && stop == start)
+        column = UINT32_MAX;
+      else if (column < columns && _ByColumn[column] >= 0)
+        StoreColumn(column, reader.Cell(start, stop), Rows);
+      reader.mapPosition = size;
+    }
+
+    if (column != UINT32_MAX) {
+      FinishRow(Rows);
+      Rows++;
+    }
+  }
+
+  return Rows - first;
+}
+
+}
+}
@@ -0,0 +1,136 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <seLib/experimental/CSVDataSet.h>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+void CSVDataSetExporter::Resolve() {
+  _Columns.clear();
+  for (DataSet* set : _Sets) {
+    // Data pointers are taken again on every Export, since an ArrayDataSet
+    // may have been resized since the last one.
+    Column column { set, set->Type(), set->RawData(), set->size() };
+    if (column.Data == nullptr)
+      column.Type = DataSetType::Generic;
+    _Columns.push_back(column);
+  }
+}
+
+void CSVDataSetExporter::WriteElement(const Column& column, size_t index) {
+  switch (column.Type) {
+  case DataSetType::Float:
+    _Writer.Write(((const float*)column.Data)[index]);
+    break;
+  case DataSetType::Double:
+    _Writer.Write(((const double*)column.Data)[index]);
+    break;
+  case DataSetType::Int8:
+    _Writer.Write((int32_t)((const int8_t*)column.Data)[index]);
+    break;
+  case DataSetType::Int16:
+    _Writer.Write((int32_t)((const int16_t*)column.Data)[index]);
+    break;
+  case DataSetType::Int32:
+    _Writer.Write(((const int32_t*)column.Data)[index]);
+    break;
+  case DataSetType::Int64:
+    _Writer.Write(((const int64_t*)column.Data)[index]);
+    break;
+  case DataSetType::UInt8:
+    _Writer.Write((uint32_t)((const uint8_t*)column.Data)[index]);
+    break;
+  case DataSetType::UInt16:
+    _Writer.Write((uint32_t)((const uint16_t*)column.Data)[index]);
+    break;
+  case DataSetType::UInt32:
+    _Writer.Write(((const uint32_t*)column.Data)[index]);
+    break;
+  case DataSetType::UInt64:
+    _Writer.Write(((const uint64_t*)column.Data)[index]);
+    break;
+  default:
+    _Writer.Write(string_view(column.Set->to_string(index)));
+    break;
+  }
+}
+
+string CSVDataSetExporter::ColumnName(size_t index) {
+  string name = _Columns[index].Set->Name();
+  if (name.empty())
+    name = "Column" + to_string(index);
+  return name;
+}
+
+size_t CSVDataSetExporter::Export() {
+  Resolve();
+
+  if (Layout == Rows) {
+    for (size_t c = 0; c < _Columns.size(); c++) {
+      const Column& column = _Columns[c];
+      _Writer.Write(string_view(ColumnName(c)));
+      for (size_t i = 0; i < column.Size; i++)
+        WriteElement(column, i);
+      _Writer.EndLine();
+    }
+    return _Columns.size();
+  }
+
+  if (Header && !_HeaderWritten) {
+    if (IndexColumn)
+      _Writer.Write("Index");
+    for (size_t c = 0; c < _Columns.size(); c++)
+      _Writer.Write(string_view(ColumnName(c)));
+    _Writer.EndLine();
+    _HeaderWritten = true;
+  }
+
+  size_t rows = 0;
+  for (auto& column : _Columns) {
+    if (column.Size > rows)
+      rows = column.Size;
+  }
+
+  if (_Columns.size() == 1 && !IndexColumn) {
+    // A single set, such as a spectrum: no per-row column loop.
+    const Column& column = _Columns[0];
+    for (size_t i = 0; i < rows; i++) {
+      WriteElement(column, i);
+      _Writer.EndLine();
+    }
+    return rows;
+  }
+
+  for (size_t i = 0; i < rows; i++) {
+    if (IndexColumn)
+      _Writer.Write((uint64_t)i);
+    for (auto& column : _Columns) {
+      // Shorter sets leave their cells empty.
+      if (i < column.Size)
+        WriteElement(column, i);
+      else
+        _Writer.Skip();
+    }
+    _Writer.EndLine();
+  }
+  return rows;
+}
+
+}
+}
@@ -14,9 +14,24 @@
    limitations under the License.
 */
 
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
 #include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 #include <seLib/experimental/CSVFile.h>
+#include <seLib/experimental/CSVRowIndex.h>
 
 namespace seLib {
 namespace CSVFile {
@@ -24,12 +39,142 @@ namespace CSVFile {
 using namespace std;
 using namespace seLib;
 
+//== Read-ahead ========================================================================
+
+// Buffers filled in order by a background thread. The consumer owns the
+// current buffer until Next, so it is never overwritten while rows in it
+// are being parsed.
+class CSVReadAhead {
+protected:
+  struct Buffer {
+    vector<char> Data;
+    size_t Length = 0;
+  };
+
+  int _Fd;
+  vector<Buffer> _Buffers;
+  mutex _Lock;
+  condition_variable _Changed;
+  size_t _Head = 0;      // next buffer to fill
+  size_t _Tail = 0;      // current buffer of the consumer
+  size_t _Filled = 0;    // filled buffers, including the current one
+  bool _Current = false;
+  bool _End = false;
+  bool _Error = false;
+  bool _Stop = false;
+  thread _Thread;
+
+public:
+  const char* Data = nullptr;
+  size_t Length = 0;
+  size_t Position = 0;
+
+  CSVReadAhead(int fd, size_t bufferSize, unsigned int bufferCount) :
+    _Fd(fd), _Buffers(bufferCount)
+  {
+    for (auto& buffer : _Buffers)
+      buffer.Data.resize(bufferSize);
+    _Thread = thread([this]() { Run(); });
+  }
+
+  ~CSVReadAhead() {
+    {
+      lock_guard<mutex> lock(_Lock);
+      _Stop = true;
+    }
+    _Changed.notify_all();
+    _Thread.join();
+    close(_Fd);
+  }
+
+  // Release the current buffer and wait for the next one. Returns false at
+  // the end of the file.
+  bool Next() {
+    unique_lock<mutex> lock(_Lock);
+    if (_Current) {
+      _Tail = (_Tail + 1) % _Buffers.size();
+      _Filled--;
+      _Current = false;
+      _Changed.notify_all();
+    }
+    _Changed.wait(lock, [this]() { return _Filled > 0 || _End || _Error; });
+    if (_Filled == 0) {
+      if (_Error)
+        throw exception();
+      Data = nullptr;
+      Length = 0;
+      Position = 0;
+      return false;
+    }
+    _Current = true;
+    Data = _Buffers[_Tail].Data.data();
+    Length = _Buffers[_Tail].Length;
+    Position = 0;
+    return true;
+  }
+
+  // True if the current buffer is used up and no more data will follow.
+  bool AtEnd() {
+    if (Position < Length)
+      return false;
+    lock_guard<mutex> lock(_Lock);
+    return _End && _Filled <= (_Current ? 1u : 0u);
+  }
+
+protected:
+  void Run() {
+    uint64_t offset = 0;
+    for (;;) {
+      size_t index;
+      {
+        unique_lock<mutex> lock(_Lock);
+        _Changed.wait(lock, [this]() { return _Stop || _Filled < _Buffers.size(); });
+        if (_Stop)
+          return;
+        index = _Head;
+      }
+
+      // The buffer is free until it is published below.
+      Buffer& buffer = _Buffers[index];
+      size_t length = 0;
+      bool error = false;
+      while (length < buffer.Data.size()) {
+        ssize_t count = pread(_Fd, buffer.Data.data() + length, buffer.Data.size() - length, (off_t)(offset + length));
+        if (count < 0 && errno == EINTR)
+          continue;
+        if (count < 0)
+          error = true;
+        if (count <= 0)
+          break;
+        length += (size_t)count;
+      }
+      buffer.Length = length;
+      offset += length;
+
+      lock_guard<mutex> lock(_Lock);
+      if (length > 0) {
+        _Head = (_Head + 1) % _Buffers.size();
+        _Filled++;
+      }
+      if (error)
+        _Error = true;
+      else if (length < buffer.Data.size())
+        _End = true;
+      _Changed.notify_all();
+      if (_Error || _End)
+        return;
+    }
+  }
+};
+
+//====================================================================================
+
 CSVReader::CSVReader() {
   readBuffer = new char[1024];
 }
 
 CSVReader::~CSVReader() {
-  delete readBuffer;
+  delete[] readBuffer;
   Close();
 }
 
@@ -45,10 +190,60 @@ void CSVReader::Open(istream& source) {
   reader = &source;
 }
 
+void CSVReader::OpenMapped(const string& fileName) {
+  Close();
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw exception();
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw exception();
+  }
+  mapSize = (size_t)st.st_size;
+  if (mapSize > 0) {
+    void* mapping = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      throw exception();
+    }
+    madvise(mapping, mapSize, MADV_SEQUENTIAL);
+    mapData = (const char*)mapping;
+  }
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  mapPosition = 0;
+  mapped = true;
+  FileName = fileName;
+  cursorReady = false;
+}
+
+void CSVReader::OpenReadAhead(const string& fileName, size_t bufferSize, unsigned int bufferCount) {
+  Close();
+  if (bufferSize == 0 || bufferCount < 2)
+    throw exception();
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw exception();
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  readAhead = new CSVReadAhead(fd, bufferSize, bufferCount);
+  FileName = fileName;
+}
+
 void CSVReader::Close() {
+  delete readAhead;
+  readAhead = nullptr;
   if (reader != nullptr && !FileName.empty())
     delete reader;
   reader = nullptr;
+  if (mapData != nullptr)
+    munmap((void*)mapData, mapSize);
+  mapData = nullptr;
+  mapSize = 0;
+  mapPosition = 0;
+  mapped = false;
+  cursorReady = false;
+  cells.clear();
 }
 
 bool CSVReader::ReadLine(unsigned int maxCellCount) {
@@ -107,6 +302,525 @@ bool CSVReader::ReadLine(unsigned int maxCellCount) {
   return true;
 }
 
+const char* CSVReader::FindRowEnd(const char* begin, const char* end, RowState* state) const {
+  bool inquote = false;
+  bool escaped = false;
+  if (state != nullptr) {
+    inquote = state->InQuote;
+    escaped = state->Escaped;
+  }
+
+  if (!inquote && !escaped) {
+    const char* newline = (const char*)memchr(begin, '\n', end - begin);
+    if (newline == nullptr)
+      newline = end;
+    // Most rows have no quotes or escapes; memchr finds those at memory speed.
+    if (memchr(begin, '\\', newline - begin) == nullptr &&
+        (!ParseQuotes || memchr(begin, '\"', newline - begin) == nullptr))
+      return newline;
+  }
+
+  const char* p = begin;
+  if (escaped && p < end) {
+    p++;
+    escaped = false;
+  }
+  for (; p < end; p++) {
+    char c = *p;
+    if (c == '\\') {
+      if (p + 1 == end) {
+        escaped = true;
+        break;
+      }
+      p++;
+    } else if (ParseQuotes && c == '\"') {
+      inquote = !inquote;
+    } else if (c == '\n' && !inquote) {
+      if (state != nullptr)
+        *state = RowState();
+      return p;
+    }
+  }
+  if (state != nullptr) {
+    state->InQuote = inquote;
+    state->Escaped = escaped;
+  }
+  return end;
+}
+
+void CSVReader::Unescape(string_view cell, string& out) {
+  const char* p = cell.data();
+  const char* end = p + cell.size();
+  while (p < end) {
+    const char* backslash = (const char*)memchr(p, '\\', end - p);
+    if (backslash == nullptr) {
+      out.append(p, end);
+      return;
+    }
+    out.append(p, backslash);
+    if (backslash + 1 < end)
+      out += *(backslash + 1);
+    p = backslash + 2;
+  }
+}
+
+string CSVReader::Unescape(string_view cell) {
+  string out;
+  Unescape(cell, out);
+  return out;
+}
+
+string_view CSVReader::Cell(const char* start, const char* stop) const {
+  while (start < stop && IsSpace(*start))
+    start++;
+
+  if (ParseQuotes && start < stop && *start == '\"') {
+    const char* p = ++start;
+    while (p < stop && *p != '\"') {
+      if (*p == '\\' && p + 1 < stop)
+        p++;
+      p++;
+    }
+    return string_view(start, (p < stop) ? p - start : stop - start);
+  }
+
+  // Trim trailing whitespace, but not an escaped character.
+  while (stop > start && IsSpace(*(stop - 1))) {
+    size_t backslashes = 0;
+    for (const char* b = stop - 1; b > start && *(b - 1) == '\\'; b--)
+      backslashes++;
+    if (backslashes & 1)
+      break;
+    stop--;
+  }
+  return string_view(start, stop - start);
+}
+
+void CSVReader::ParseRow(const char* begin, const char* end, unsigned int maxCellCount) {
+  cells.clear();
+  if (end > begin && *(end - 1) == '\r')
+    end--;
+  if (begin >= end)
+    return;
+
+  const char* start = begin;
+  bool inquote = false;
+  for (const char* p = begin; p < end; p++) {
+    char c = *p;
+    if (c == '\\') {
+      p++;
+    } else if (ParseQuotes && c == '\"') {
+      inquote = !inquote;
+    } else if (c == Separator && !inquote) {
+      cells.push_back(Cell(start, p));
+      if (maxCellCount > 0 && cells.size() >= maxCellCount)
+        return;
+      start = p + 1;
+    }
+  }
+  cells.push_back(Cell(start, end));
+}
+
+size_t CSVReader::ParseIndexedRow(CSVStructuralCursor& rowCursor, size_t position, unsigned int maxCellCount, vector<string_view>& out) const {
+  const char* data = rowCursor.Data;
+  const char* start = data + position;
+  size_t first = out.size();
+  size_t next;
+
+  while (rowCursor.Next(next)) {
+    const char* stop = data + next;
+    bool full = (maxCellCount > 0 && out.size() - first >= maxCellCount);
+    if (*stop == '\n') {
+      if (stop > start && *(stop - 1) == '\r')
+        stop--;
+      if ((out.size() > first || stop > start) && !full)
+        out.push_back(Cell(start, stop));
+      return next + 1;
+    }
+    if (!full)
+      out.push_back(Cell(start, stop));
+    start = stop + 1;
+  }
+
+  // Last row without a line break.
+  const char* stop = data + rowCursor.Size;
+  if (stop > start && *(stop - 1) == '\r')
+    stop--;
+  if ((out.size() > first || stop > start) && (maxCellCount == 0 || out.size() - first < maxCellCount))
+    out.push_back(Cell(start, stop));
+  return rowCursor.Size;
+}
+
+bool CSVReader::ReadIndexedRow(unsigned int maxCellCount) {
+  cells.clear();
+  if (mapPosition >= mapSize)
+    return false;
+  if (!cursorReady) {
+    cursor.Reset(mapData, mapSize, mapPosition, Separator, ParseQuotes);
+    cursorReady = true;
+  }
+  mapPosition = ParseIndexedRow(cursor, mapPosition, maxCellCount, cells);
+  return true;
+}
+
+bool CSVReader::ReadAheadAtEnd() {
+  return readAhead->AtEnd();
+}
+
+bool CSVReader::ReadAheadRow(unsigned int maxCellCount) {
+  CSVReadAhead& buffers = *readAhead;
+  RowState state;
+
+  // Most rows lie inside the current buffer.
+  lineBuffer.clear();
+  if (buffers.Position < buffers.Length) {
+    const char* begin = buffers.Data + buffers.Position;
+    const char* end = buffers.Data + buffers.Length;
+    const char* rowEnd = FindRowEnd(begin, end, &state);
+    if (rowEnd < end) {
+      buffers.Position = (size_t)(rowEnd - buffers.Data) + 1;
+      ParseRow(begin, rowEnd, maxCellCount);
+      return true;
+    }
+    lineBuffer.assign(begin, end);
+    buffers.Position = buffers.Length;
+  }
+
+  // The row continues in the next buffer. Scan each following buffer from
+  // the state the last one ended in, and add it to lineBuffer up to the end
+  // of the row.
+  for (;;) {
+    if (buffers.Position >= buffers.Length && !buffers.Next()) {
+      cells.clear();
+      if (lineBuffer.empty())
+        return false;
+      ParseRow(lineBuffer.data(), lineBuffer.data() + lineBuffer.size(), maxCellCount);
+      return true;
+    }
+    const char* begin = buffers.Data + buffers.Position;
+    const char* end = buffers.Data + buffers.Length;
+    const char* rowEnd = FindRowEnd(begin, end, &state);
+    lineBuffer.append(begin, rowEnd);
+    if (rowEnd < end) {
+      buffers.Position = (size_t)(rowEnd - buffers.Data) + 1;
+      ParseRow(lineBuffer.data(), lineBuffer.data() + lineBuffer.size(), maxCellCount);
+      return true;
+    }
+    buffers.Position = buffers.Length;
+  }
+}
+
+bool CSVReader::ReadRow(unsigned int maxCellCount) {
+  if (mapped && UseStructuralIndex)
+    return ReadIndexedRow(maxCellCount);
+
+  if (readAhead != nullptr)
+    return ReadAheadRow(maxCellCount);
+
+  if (mapped) {
+    if (mapPosition >= mapSize) {
+      cells.clear();
+      return false;
+    }
+    const char* begin = mapData + mapPosition;
+    const char* end = mapData + mapSize;
+    const char* rowEnd = FindRowEnd(begin, end);
+    mapPosition = (rowEnd < end) ? (size_t)(rowEnd - mapData) + 1 : mapSize;
+    ParseRow(begin, rowEnd, maxCellCount);
+    return true;
+  }
+
+  cells.clear();
+  if (reader == nullptr || !getline(*reader, lineBuffer))
+    return false;
+
+  // A quoted cell, or a line ending in an escaping backslash, continues on
+  // the following lines. Only the added line is scanned each time.
+  RowState state;
+  FindRowEnd(lineBuffer.data(), lineBuffer.data() + lineBuffer.size(), &state);
+  bool terminated = !reader->eof();
+  string line;
+  while (state.Open() && getline(*reader, line)) {
+    size_t from = lineBuffer.size();
+    lineBuffer += '\n';
+    lineBuffer += line;
+    FindRowEnd(lineBuffer.data() + from, lineBuffer.data() + lineBuffer.size(), &state);
+    terminated = !reader->eof();
+  }
+  // A file ending inside quotes or after an escaping backslash keeps its last
+  // line break, as in mapped mode.
+  if (state.Open() && terminated)
+    lineBuffer += '\n';
+
+  ParseRow(lineBuffer.data(), lineBuffer.data() + lineBuffer.size(), maxCellCount);
+  return true;
+}
+
+//== Random access ========================================================================
+
+bool CSVReader::IndexMatches() const {
+  return rowIndex != nullptr && rowIndex->SourceSize == mapSize && rowIndex->Separator == Separator &&
+    rowIndex->ParseQuotes == ParseQuotes && !rowIndex->Offsets.empty();
+}
+
+void CSVReader::SkipRows(uint64_t count) {
+  if (!UseStructuralIndex) {
+    for (; count > 0 && mapPosition < mapSize; count--) {
+      const char* rowEnd = FindRowEnd(mapData + mapPosition, mapData + mapSize);
+      mapPosition = (size_t)(rowEnd - mapData) + 1;
+    }
+    if (mapPosition > mapSize)
+      mapPosition = mapSize;
+    return;
+  }
+
+  if (count == 0)
+    return;
+  if (!cursorReady) {
+    cursor.Reset(mapData, mapSize, mapPosition, Separator, ParseQuotes);
+    cursorReady = true;
+  }
+  size_t position;
+  while (cursor.Next(position)) {
+    if (mapData[position] == '\n' && --count == 0) {
+      mapPosition = position + 1;
+      return;
+    }
+  }
+  mapPosition = mapSize;
+}
+
+bool CSVReader::Seek(uint64_t row) {
+  if (!mapped)
+    throw exception();
+
+  uint64_t current = 0;
+  mapPosition = IndexMatches() ? (size_t)rowIndex->Locate(row, current) : 0;
+  cursorReady = false;
+  cells.clear();
+  SkipRows(row - current);
+  // The cursor has indexed past the new position; restart it there.
+  cursorReady = false;
+  return mapPosition < mapSize;
+}
+
+size_t CSVReader::ReadRange(uint64_t first, size_t count, CSVTable& table, unsigned int maxCellCount) {
+  table.clear();
+  table.rowStarts.push_back(0);
+  if (!Seek(first))
+    return 0;
+
+  if (!cursorReady) {
+    cursor.Reset(mapData, mapSize, mapPosition, Separator, ParseQuotes);
+    cursorReady = true;
+  }
+  size_t rows = 0;
+  for (; rows < count && mapPosition < mapSize; rows++) {
+    if (UseStructuralIndex) {
+      mapPosition = ParseIndexedRow(cursor, mapPosition, maxCellCount, table.cells);
+    } else {
+      ReadRow(maxCellCount);
+      table.cells.insert(table.cells.end(), cells.begin(), cells.end());
+    }
+    table.rowStarts.push_back(table.cells.size());
+  }
+  return rows;
+}
+
+bool CSVReader::SeekValue(unsigned int column, double value) {
+  if (!mapped)
+    throw exception();
+
+  // Value of column in the row at position, or -inf if it is not a number.
+  auto valueAt = [this, column](size_t position) {
+    const char* begin = mapData + position;
+    ParseRow(begin, FindRowEnd(begin, mapData + mapSize), column + 1);
+    double cell = -numeric_limits<double>::infinity();
+    if (column < cells.size()) {
+      string_view text = cells[column];
+      const char* p = text.data();
+      const char* end = p + text.size();
+      if (p < end && *p == '+')
+        p++;
+      double parsed;
+      auto result = from_chars(p, end, parsed);
+      if (result.ec == errc() && result.ptr == end)
+        cell = parsed;
+    }
+    return cell;
+  };
+
+  // Last indexed row at or after the current position whose value is below
+  // value; the first row reaching value is at most an interval further.
+  size_t start = mapPosition;
+  if (IndexMatches()) {
+    auto& offsets = rowIndex->Offsets;
+    size_t low = (size_t)(lower_bound(offsets.begin(), offsets.end(), (uint64_t)mapPosition) - offsets.begin());
+    size_t high = offsets.size();
+    while (low < high) {
+      size_t middle = low + (high - low) / 2;
+      if (valueAt((size_t)offsets[middle]) < value)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    if (low > 0 && offsets[low - 1] > start)
+      start = (size_t)offsets[low - 1];
+  }
+
+  cursorReady = false;
+  cells.clear();
+  mapPosition = start;
+  while (mapPosition < mapSize) {
+    if (valueAt(mapPosition) >= value) {
+      cells.clear();
+      return true;
+    }
+    const char* rowEnd = FindRowEnd(mapData + mapPosition, mapData + mapSize);
+    mapPosition = (size_t)(rowEnd - mapData) + 1;
+  }
+  mapPosition = mapSize;
+  cells.clear();
+  return false;
+}
+
+//====================================================================================
+
+struct CSVChunk {
+  size_t From = 0;    // first row start
+  size_t Stop = 0;    // rows starting at or after Stop belong to the next chunk
+  size_t Landing = 0; // start of the row after the last one parsed
+  vector<string_view> Cells;
+  vector<size_t> RowStarts;
+};
+
+// First row start at or after offset, assuming the newline before it is not
+// inside quotes: just past the first newline not escaped by a backslash.
+static size_t SpeculativeRowStart(const char* data, size_t size, size_t offset) {
+  while (offset < size) {
+    const char* newline = (const char*)memchr(data + offset, '\n', size - offset);
+    if (newline == nullptr)
+      return size;
+    size_t backslashes = 0;
+    for (const char* b = newline; b > data && *(b - 1) == '\\'; b--)
+      backslashes++;
+    offset = (size_t)(newline - data) + 1;
+    if ((backslashes & 1) == 0)
+      return offset;
+  }
+  return size;
+}
+
+void CSVReader::ReadAll(CSVTable& table, unsigned int threadCount, unsigned int maxCellCount) {
+  if (!mapped)
+    throw exception();
+  table.clear();
+  table.rowStarts.push_back(0);
+  if (mapPosition >= mapSize)
+    return;
+
+  if (threadCount == 0)
+    threadCount = thread::hardware_concurrency();
+  if (threadCount == 0)
+    threadCount = 1;
+
+  // Several chunks per thread balance uneven rows; each is at least 1 MB.
+  size_t remaining = mapSize - mapPosition;
+  size_t chunkCount = threadCount * 4;
+  size_t chunkSize = remaining / chunkCount + 1;
+  if (chunkSize < (1 << 20)) {
+    chunkSize = 1 << 20;
+    chunkCount = remaining / chunkSize + 1;
+  }
+
+  // Each chunk guesses that it starts outside quotes, at the first newline
+  // after its nominal offset, and parses its rows independently. With a row
+  // index it starts at the first indexed row after that offset instead,
+  // which is known to be a row start.
+  bool indexed = IndexMatches();
+  vector<CSVChunk> chunks(chunkCount);
+  for (size_t i = 0; i < chunkCount; i++) {
+    size_t from = mapPosition;
+    if (i > 0 && indexed) {
+      auto& offsets = rowIndex->Offsets;
+      auto next = lower_bound(offsets.begin(), offsets.end(), (uint64_t)(mapPosition + i * chunkSize));
+      from = (next != offsets.end()) ? (size_t)*next : mapSize;
+    } else if (i > 0) {
+      from = SpeculativeRowStart(mapData, mapSize, mapPosition + i * chunkSize);
+    }
+    chunks[i].From = (i == 0 || from > chunks[i - 1].From) ? from : chunks[i - 1].From;
+  }
+  for (size_t i = 0; i < chunkCount; i++)
+    chunks[i].Stop = (i + 1 < chunkCount) ? chunks[i + 1].From : mapSize;
+
+  auto parse = [this, maxCellCount](CSVChunk& chunk) {
+    chunk.Cells.clear();
+    chunk.RowStarts.clear();
+    // Rough guess to avoid most regrowth; cells are rarely under 8 bytes.
+    chunk.Cells.reserve((chunk.Stop - chunk.From) / 8);
+    CSVStructuralCursor rowCursor;
+    rowCursor.Reset(mapData, mapSize, chunk.From, Separator, ParseQuotes);
+    size_t position = chunk.From;
+    while (position < chunk.Stop) {
+      chunk.RowStarts.push_back(chunk.Cells.size());
+      position = ParseIndexedRow(rowCursor, position, maxCellCount, chunk.Cells);
+    }
+    chunk.Landing = position;
+  };
+
+  auto runParallel = [threadCount, chunkCount](const function<void(size_t)>& work) {
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+      size_t i;
+      while ((i = next.fetch_add(1)) < chunkCount)
+        work(i);
+    };
+    vector<thread> threads;
+    for (unsigned int t = 1; t < threadCount; t++)
+      threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+      t.join();
+  };
+
+  runParallel([&](size_t i) { parse(chunks[i]); });
+
+  // Validate the guesses in order: a chunk guessed right if the previous one
+  // ended its last row exactly where this one started. Otherwise the guessed
+  // newline was inside quotes, and the chunk is parsed again from where the
+  // previous chunk really ended.
+  size_t expected = mapPosition;
+  for (auto& chunk : chunks) {
+    if (chunk.From != expected) {
+      chunk.From = expected;
+      parse(chunk);
+    }
+    expected = chunk.Landing;
+  }
+
+  // Stitch the chunks together in order.
+  vector<size_t> cellOffsets(chunkCount + 1, 0);
+  vector<size_t> rowOffsets(chunkCount + 1, 0);
+  for (size_t i = 0; i < chunkCount; i++) {
+    cellOffsets[i + 1] = cellOffsets[i] + chunks[i].Cells.size();
+    rowOffsets[i + 1] = rowOffsets[i] + chunks[i].RowStarts.size();
+  }
+  table.cells.resize(cellOffsets[chunkCount]);
+  table.rowStarts.resize(rowOffsets[chunkCount] + 1);
+  table.rowStarts[rowOffsets[chunkCount]] = cellOffsets[chunkCount];
+
+  runParallel([&](size_t i) {
+    CSVChunk& chunk = chunks[i];
+    copy(chunk.Cells.begin(), chunk.Cells.end(), table.cells.begin() + cellOffsets[i]);
+    for (size_t r = 0; r < chunk.RowStarts.size(); r++)
+      table.rowStarts[rowOffsets[i] + r] = cellOffsets[i] + chunk.RowStarts[r];
+    vector<string_view>().swap(chunk.Cells);
+  });
+
+  mapPosition = mapSize;
+  cursorReady = false;
+}
+
 //============================================================================
 
 
@@ -120,7 +834,8 @@ CSVFileWriter::~CSVFileWriter() {
 }
 
 void CSVFileWriter::Flush() {
-  writer->flush();
+  if (writer != nullptr)
+    writer->flush();
 }
 
 void CSVFileWriter::Close() {
@@ -130,13 +845,13 @@ void CSVFileWriter::Close() {
   writer = nullptr;
 }
 
-void CSVFileWriter::WriteLine(vector<string> data) {
+void CSVFileWriter::WriteLine(const vector<string>& data) {
   string line = "";
   for (int i = 0; i < (int)data.size(); i++) {
     if (i > 0)
       *writer << Separator;
 
-    string& s = data[i];
+    const string& s = data[i];
     //double d;
     try {
       stod(s); // see if string is parseable number, enclose in quotes otherwise
@@ -147,6 +862,155 @@ void CSVFileWriter::WriteLine(vector<string> data) {
       *writer << '\"';
     }
   }
+  *writer << '\n';
+}
+
+//============================================================================
+
+CSVBufferedWriter::CSVBufferedWriter(const string& fileName, size_t bufferSize) {
+  _Fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (_Fd < 0)
+    throw exception();
+  _Owner = true;
+  FileName = fileName;
+  _Buffer.resize((bufferSize > 4096) ? bufferSize : 4096);
+}
+
+CSVBufferedWriter::CSVBufferedWriter(int fd, size_t bufferSize) {
+  _Fd = fd;
+  _Buffer.resize((bufferSize > 4096) ? bufferSize : 4096);
+}
+
+CSVBufferedWriter::~CSVBufferedWriter() {
+  // A failed write must not escape a destructor; Close has already closed
+  // the file.
+  try {
+    Close();
+  } catch (...) {
+  }
+}
+
+void CSVBufferedWriter::FlushBuffer(size_t needed) {
+  const char* p = _Buffer.data();
+  size_t len = _Used;
+  while (len > 0) {
+    ssize_t written = write(_Fd, p, len);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      throw exception();
+    }
+    p += written;
+    len -= (size_t)written;
+  }
+  _Used = 0;
+  if (needed > _Buffer.size())
+    _Buffer.resize(needed);
+}
+
+template <typename T>
+void CSVBufferedWriter::WriteNumber(T value) {
+  BeginCell();
+  // Enough for any float, double or 64-bit integer.
+  char* out = Reserve(32);
+  auto result = to_chars(out, out + 32, value);
+  _Used += result.ptr - out;
+}
+
+void CSVBufferedWriter::Write(float value) {
+  WriteNumber(value);
+}
+
+void CSVBufferedWriter::Write(double value) {
+  WriteNumber(value);
+}
+
+void CSVBufferedWriter::Write(int32_t value) {
+  WriteNumber(value);
+}
+
+void CSVBufferedWriter::Write(int64_t value) {
+  WriteNumber(value);
+}
+
+void CSVBufferedWriter::Write(uint32_t value) {
+  WriteNumber(value);
+}
+
+void CSVBufferedWriter::Write(uint64_t value) {
+  WriteNumber(value);
+}
+
+bool CSVBufferedWriter::NeedsQuotes(string_view value) const {
+  if (value.empty())
+    return false;
+  if (value.front() == ' ' || value.front() == '\t' || value.back() == ' ' || value.back() == '\t')
+    return true;
+  for (char c : value) {
+    if (c == Separator || c == '\"' || c == '\\' || c == '\n' || c == '\r')
+      return true;
+  }
+  return false;
+}
+
+void CSVBufferedWriter::Write(string_view value) {
+  BeginCell();
+  if (!NeedsQuotes(value)) {
+    char* out = Reserve(value.size());
+    memcpy(out, value.data(), value.size());
+    _Used += value.size();
+    return;
+  }
+
+  // Worst case every character is escaped.
+  char* out = Reserve(value.size() * 2 + 2);
+  char* p = out;
+  *p++ = '\"';
+  for (char c : value) {
+    if (c == '\"' || c == '\\')
+      *p++ = '\\';
+    *p++ = c;
+  }
+  *p++ = '\"';
+  _Used += p - out;
+}
+
+void CSVBufferedWriter::Skip() {
+  BeginCell();
+}
+
+void CSVBufferedWriter::EndLine() {
+  *Reserve(1) = '\n';
+  _Used++;
+  _LineStart = true;
+}
+
+void CSVBufferedWriter::WriteLine(const vector<string>& data) {
+  for (auto& cell : data)
+    Write(string_view(cell));
+  EndLine();
+}
+
+void CSVBufferedWriter::Flush() {
+  if (_Fd >= 0)
+    FlushBuffer();
+}
+
+void CSVBufferedWriter::Close() {
+  if (_Fd < 0)
+    return;
+  try {
+    FlushBuffer();
+  } catch (...) {
+    if (_Owner)
+      close(_Fd);
+    _Fd = -1;
+    _Used = 0;
+    throw;
+  }
+  if (_Owner)
+    close(_Fd);
+  _Fd = -1;
 }
 
 }
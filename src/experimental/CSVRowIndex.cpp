@@ -0,0 +1,183 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <exception>
+
+#include <seLib/experimental/CSVStructural.h>
+#include <seLib/experimental/CSVRowIndex.h>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+static const char RowIndexMagic[4] = { 'S', 'C', 'R', 'I' };
+
+static inline int64_t ModifiedTime(const struct stat& info) {
+  return (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+void CSVRowIndex::BuildBuffer(const char* data, size_t size, uint32_t interval, char separator, bool parseQuotes) {
+  if (interval == 0)
+    throw exception();
+  Interval = interval;
+  Separator = separator;
+  ParseQuotes = parseQuotes;
+  Offsets.clear();
+  Offsets.push_back(0);
+  Rows = 0;
+
+  CSVStructuralCursor cursor;
+  cursor.Reset(data, size, 0, separator, parseQuotes);
+  size_t position;
+  size_t rowStart = 0;
+  uint32_t sinceLast = 0;
+  while (cursor.Next(position)) {
+    if (data[position] != '\n')
+      continue;
+    Rows++;
+    rowStart = position + 1;
+    if (++sinceLast == interval && position + 1 < size) {
+      Offsets.push_back(position + 1);
+      sinceLast = 0;
+    }
+  }
+  // A last row without a row-ending line break, which may still end in a
+  // quoted or escaped one.
+  if (rowStart < size)
+    Rows++;
+}
+
+void CSVRowIndex::Build(const string& source, uint32_t interval, char separator, bool parseQuotes) {
+  int fd = open(source.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw exception();
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw exception();
+  }
+  size_t size = (size_t)info.st_size;
+  void* data = nullptr;
+  if (size > 0) {
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw exception();
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  BuildBuffer((const char*)data, size, interval, separator, parseQuotes);
+  SourceSize = size;
+  SourceModified = ModifiedTime(info);
+  if (data != nullptr)
+    munmap(data, size);
+}
+
+void CSVRowIndex::Save(const string& path) const {
+  CSVRowIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.Magic, RowIndexMagic, sizeof(RowIndexMagic));
+  header.Version = Version;
+  header.SourceSize = SourceSize;
+  header.SourceModified = SourceModified;
+  header.Rows = Rows;
+  header.Interval = Interval;
+  header.Separator = Separator;
+  header.ParseQuotes = ParseQuotes ? 1 : 0;
+
+  // Write to a temporary file and rename it, so a reader never loads a
+  // partly written index.
+  string temporary = path + ".tmp";
+  FILE* file = fopen(temporary.c_str(), "wb");
+  if (file == nullptr)
+    throw exception();
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(Offsets.data(), sizeof(uint64_t), Offsets.size(), file) == Offsets.size();
+  if (fclose(file) != 0)
+    written = false;
+  if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+    unlink(temporary.c_str());
+    throw exception();
+  }
+}
+
+void CSVRowIndex::Load(const string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    throw exception();
+  CSVRowIndexHeader header;
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+    memcmp(header.Magic, RowIndexMagic, sizeof(RowIndexMagic)) == 0 && header.Version == Version && header.Interval != 0;
+  if (valid) {
+    // One offset per Interval rows, and always one for row 0.
+    size_t count = (size_t)((header.Rows + header.Interval - 1) / header.Interval);
+    if (count == 0)
+      count = 1;
+    Offsets.resize(count);
+    valid = fread(Offsets.data(), sizeof(uint64_t), count, file) == count;
+  }
+  fclose(file);
+  if (!valid)
+    throw exception();
+
+  Interval = header.Interval;
+  Separator = header.Separator;
+  ParseQuotes = header.ParseQuotes != 0;
+  SourceSize = header.SourceSize;
+  SourceModified = header.SourceModified;
+  Rows = header.Rows;
+}
+
+bool CSVRowIndex::IsCurrent(const string& source, const string& path) {
+  struct stat sourceInfo;
+  struct stat info;
+  if (stat(source.c_str(), &sourceInfo) != 0 || stat(path.c_str(), &info) != 0)
+    return false;
+  if (ModifiedTime(info) < ModifiedTime(sourceInfo))
+    return false;
+
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  CSVRowIndexHeader header;
+  bool read = fread(&header, sizeof(header), 1, file) == 1;
+  fclose(file);
+  return read && memcmp(header.Magic, RowIndexMagic, sizeof(RowIndexMagic)) == 0 && header.Version == Version &&
+    header.SourceSize == (uint64_t)sourceInfo.st_size && header.SourceModified == ModifiedTime(sourceInfo);
+}
+
+void CSVRowIndex::Open(const string& source, uint32_t interval, char separator, bool parseQuotes) {
+  string path = PathFor(source);
+  if (IsCurrent(source, path)) {
+    Load(path);
+    if (Interval == interval && Separator == separator && ParseQuotes == parseQuotes)
+      return;
+  }
+  Build(source, interval, separator, parseQuotes);
+  Save(path);
+}
+
+}
+}
@@ -0,0 +1,394 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <charconv>
+#include <cmath>
+#include <exception>
+#include <limits>
+
+#include <seLib/experimental/CSVFile.h>
+#include <seLib/experimental/CSVSidecar.h>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+static const char SidecarMagic[4] = { 'S', 'C', 'S', 'C' };
+
+static inline int64_t ModifiedTime(const struct stat& info) {
+  return (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+static inline uint64_t AlignOffset(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+//== Convert ========================================================================
+
+namespace {
+
+// Same float, including the sign of zero; any NaN matches any NaN.
+inline bool SameFloat(float a, float b) {
+  if (a != a || b != b)
+    return a != a && b != b;
+  return a == b && signbit(a) == signbit(b);
+}
+
+// One column while converting. It starts as Int64, becomes Double at the
+// first missing or non-integer value and Text at the first non-number.
+// FloatExact is cleared at the first value whose narrowing to float is not
+// what from_chars<float> gives for the cell.
+struct ColumnBuilder {
+  CSVSidecarType Type = CSVSidecarType::Int64;
+  vector<int64_t> Ints;
+  vector<double> Doubles;
+  vector<uint64_t> Missing;
+  bool AnyMissing = false;
+  bool FloatExact = true;
+  string Name;
+
+  void ToDouble() {
+    Doubles.resize(Ints.size());
+    for (size_t i = 0; i < Ints.size(); i++) {
+      Doubles[i] = (double)Ints[i];
+      // Both round the exact integer, but through a double they may not
+      // agree above 2^53.
+      if (!SameFloat((float)Doubles[i], (float)Ints[i]))
+        FloatExact = false;
+    }
+    Ints = vector<int64_t>();
+    Type = CSVSidecarType::Double;
+  }
+
+  void ToText() {
+    Ints = vector<int64_t>();
+    Doubles = vector<double>();
+    Missing = vector<uint64_t>();
+    AnyMissing = false;
+    Type = CSVSidecarType::Text;
+  }
+
+  void AddMissing() {
+    if (Type == CSVSidecarType::Int64)
+      ToDouble();
+    if (Type != CSVSidecarType::Double)
+      return;
+    size_t row = Doubles.size();
+    if (Missing.size() <= row / 64)
+      Missing.resize(row / 64 + 1);
+    Missing[row / 64] |= (uint64_t)1 << (row % 64);
+    AnyMissing = true;
+    Doubles.push_back(numeric_limits<double>::quiet_NaN());
+  }
+
+  void Add(string_view cell) {
+    if (Type == CSVSidecarType::Text)
+      return;
+    if (cell.empty()) {
+      AddMissing();
+      return;
+    }
+    const char* p = cell.data();
+    const char* end = p + cell.size();
+    // from_chars does not accept a leading plus sign.
+    if (*p == '+' && end - p > 1 && *(p + 1) != '-')
+      p++;
+
+    if (Type == CSVSidecarType::Int64) {
+      int64_t value;
+      auto result = from_chars(p, end, value);
+      // A parse as double would give -0.0 for "-0".
+      if (result.ec == errc() && result.ptr == end && (value != 0 || *p != '-')) {
+        Ints.push_back(value);
+        return;
+      }
+      ToDouble();
+    }
+
+    double value;
+    auto result = from_chars(p, end, value);
+    if (result.ec != errc() || result.ptr != end) {
+      ToText();
+      return;
+    }
+    Doubles.push_back(value);
+    if (FloatExact) {
+      float narrow;
+      auto floatResult = from_chars(p, end, narrow);
+      if (floatResult.ec != errc() || floatResult.ptr != end || !SameFloat(narrow, (float)value))
+        FloatExact = false;
+    }
+  }
+
+  size_t size() const {
+    return (Type == CSVSidecarType::Int64) ? Ints.size() : Doubles.size();
+  }
+};
+
+template <typename T>
+void BlockStats(const T* values, size_t count, uint32_t blockRows, vector<CSVSidecarStats>& stats) {
+  stats.clear();
+  for (size_t start = 0; start < count; start += blockRows) {
+    size_t stop = min(count, start + (size_t)blockRows);
+    double low = numeric_limits<double>::quiet_NaN();
+    double high = numeric_limits<double>::quiet_NaN();
+    for (size_t i = start; i < stop; i++) {
+      double value = (double)values[i];
+      if (value != value)
+        continue;
+      if (!(value >= low))
+        low = value;
+      if (!(value <= high))
+        high = value;
+    }
+    stats.push_back(CSVSidecarStats { low, high });
+  }
+}
+
+void WriteAt(int fd, const void* data, size_t len, uint64_t offset) {
+  const uint8_t* p = (const uint8_t*)data;
+  while (len > 0) {
+    ssize_t written = pwrite(fd, p, len, (off_t)offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      throw exception();
+    }
+    p += written;
+    len -= (size_t)written;
+    offset += (uint64_t)written;
+  }
+}
+
+}
+
+void CSVSidecar::Convert(const string& source, const string& path, const CSVSidecarOptions& options) {
+  if (options.BlockRows == 0)
+    throw exception();
+
+  struct stat info;
+  if (stat(source.c_str(), &info) != 0)
+    throw exception();
+
+  CSVReader reader;
+  reader.Separator = options.Separator;
+  reader.ParseQuotes = options.ParseQuotes;
+  reader.OpenMapped(source);
+
+  vector<ColumnBuilder> columns;
+  if (options.HeaderRow && reader.ReadRow()) {
+    columns.resize(reader.cells.size());
+    for (size_t c = 0; c < columns.size(); c++)
+      columns[c].Name = string(reader.cells[c]);
+  }
+
+  size_t rows = 0;
+  while (reader.ReadRow()) {
+    if (reader.cells.empty())
+      continue;
+    if (reader.cells.size() > columns.size()) {
+      // A new column was missing from every earlier row.
+      size_t first = columns.size();
+      columns.resize(reader.cells.size());
+      for (size_t c = first; c < columns.size(); c++) {
+        for (size_t i = 0; i < rows; i++)
+          columns[c].AddMissing();
+      }
+    }
+    for (size_t c = 0; c < reader.cells.size(); c++)
+      columns[c].Add(reader.cells[c]);
+    for (size_t c = reader.cells.size(); c < columns.size(); c++)
+      columns[c].AddMissing();
+    rows++;
+  }
+  reader.Close();
+
+  // Lay out the file.
+  CSVSidecarHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.Magic, SidecarMagic, sizeof(SidecarMagic));
+  header.Version = Version;
+  header.SourceSize = (uint64_t)info.st_size;
+  header.SourceModified = ModifiedTime(info);
+  header.Rows = rows;
+  header.Columns = (uint32_t)columns.size();
+  header.BlockRows = options.BlockRows;
+  header.Separator = options.Separator;
+  header.ParseQuotes = options.ParseQuotes ? 1 : 0;
+  header.HeaderRow = options.HeaderRow ? 1 : 0;
+
+  vector<CSVSidecarColumn> table(columns.size());
+  uint64_t offset = sizeof(CSVSidecarHeader) + table.size() * sizeof(CSVSidecarColumn);
+  for (size_t c = 0; c < columns.size(); c++) {
+    table[c].Type = (uint32_t)columns[c].Type;
+    table[c].NameLength = (uint32_t)columns[c].Name.size();
+    table[c].NameOffset = offset;
+    offset += columns[c].Name.size();
+  }
+  size_t blocks = (rows + options.BlockRows - 1) / options.BlockRows;
+  for (size_t c = 0; c < columns.size(); c++) {
+    if (columns[c].Type == CSVSidecarType::Text)
+      continue;
+    offset = AlignOffset(offset, 64);
+    table[c].DataOffset = offset;
+    offset += rows * sizeof(int64_t);
+    if (options.BlockStats && blocks > 0) {
+      table[c].StatsOffset = offset;
+      offset += blocks * sizeof(CSVSidecarStats);
+    }
+    if (columns[c].AnyMissing) {
+      columns[c].Missing.resize((rows + 63) / 64);
+      table[c].MissingOffset = offset;
+      offset += columns[c].Missing.size() * sizeof(uint64_t);
+    }
+    if (columns[c].FloatExact)
+      table[c].Flags |= CSVSidecarFloatExact;
+  }
+
+  // Write to a temporary file and rename it, so a reader never maps a
+  // partly written sidecar.
+  string temporary = path + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    throw exception();
+  try {
+    WriteAt(fd, &header, sizeof(header), 0);
+    WriteAt(fd, table.data(), table.size() * sizeof(CSVSidecarColumn), sizeof(header));
+    vector<CSVSidecarStats> stats;
+    for (size_t c = 0; c < columns.size(); c++) {
+      ColumnBuilder& column = columns[c];
+      WriteAt(fd, column.Name.data(), column.Name.size(), table[c].NameOffset);
+      if (column.Type == CSVSidecarType::Int64) {
+        WriteAt(fd, column.Ints.data(), rows * sizeof(int64_t), table[c].DataOffset);
+        BlockStats(column.Ints.data(), rows, options.BlockRows, stats);
+      } else if (column.Type == CSVSidecarType::Double) {
+        WriteAt(fd, column.Doubles.data(), rows * sizeof(double), table[c].DataOffset);
+        BlockStats(column.Doubles.data(), rows, options.BlockRows, stats);
+      }
+      if (table[c].StatsOffset != 0)
+        WriteAt(fd, stats.data(), stats.size() * sizeof(CSVSidecarStats), table[c].StatsOffset);
+      if (table[c].MissingOffset != 0)
+        WriteAt(fd, column.Missing.data(), column.Missing.size() * sizeof(uint64_t), table[c].MissingOffset);
+    }
+    if (ftruncate(fd, (off_t)offset) != 0)
+      throw exception();
+  } catch (...) {
+    close(fd);
+    unlink(temporary.c_str());
+    throw;
+  }
+  close(fd);
+  if (rename(temporary.c_str(), path.c_str()) != 0) {
+    unlink(temporary.c_str());
+    throw exception();
+  }
+}
+
+bool CSVSidecar::IsCurrent(const string& source, const string& path) {
+  struct stat sourceInfo;
+  struct stat info;
+  if (stat(source.c_str(), &sourceInfo) != 0 || stat(path.c_str(), &info) != 0)
+    return false;
+  if (ModifiedTime(info) < ModifiedTime(sourceInfo))
+    return false;
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  CSVSidecarHeader header;
+  bool read = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+  close(fd);
+  return read && memcmp(header.Magic, SidecarMagic, sizeof(SidecarMagic)) == 0 && header.Version == Version &&
+    header.SourceSize == (uint64_t)sourceInfo.st_size && header.SourceModified == ModifiedTime(sourceInfo);
+}
+
+//== Loader ========================================================================
+
+CSVSidecar::~CSVSidecar() {
+  Close();
+}
+
+void CSVSidecar::Open(const string& path) {
+  Close();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw exception();
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CSVSidecarHeader)) {
+    close(fd);
+    throw exception();
+  }
+  void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    throw exception();
+  _Data = (const uint8_t*)data;
+  _Size = (size_t)info.st_size;
+  _Header = (const CSVSidecarHeader*)_Data;
+  _Columns = (const CSVSidecarColumn*)(_Data + sizeof(CSVSidecarHeader));
+
+  // Check every offset before handing out pointers into the mapping.
+  bool valid = memcmp(_Header->Magic, SidecarMagic, sizeof(SidecarMagic)) == 0 && _Header->Version == Version &&
+    _Header->BlockRows != 0 && _Header->Rows <= _Size / sizeof(int64_t) &&
+    _Header->Columns <= (_Size - sizeof(CSVSidecarHeader)) / sizeof(CSVSidecarColumn);
+  for (size_t c = 0; valid && c < _Header->Columns; c++) {
+    const CSVSidecarColumn& column = _Columns[c];
+    uint64_t bytes = _Header->Rows * sizeof(int64_t);
+    uint64_t statsBytes = BlockCount() * sizeof(CSVSidecarStats);
+    uint64_t missingBytes = (_Header->Rows + 63) / 64 * sizeof(uint64_t);
+    valid = column.NameOffset <= _Size && column.NameLength <= _Size - column.NameOffset;
+    if (column.Type == (uint32_t)CSVSidecarType::Int64 || column.Type == (uint32_t)CSVSidecarType::Double)
+      valid = valid && column.DataOffset % 64 == 0 && column.DataOffset <= _Size && bytes <= _Size - column.DataOffset;
+    else
+      valid = valid && column.Type == (uint32_t)CSVSidecarType::Text && column.StatsOffset == 0 && column.MissingOffset == 0;
+    if (column.StatsOffset != 0)
+      valid = valid && column.StatsOffset % 8 == 0 && column.StatsOffset <= _Size && statsBytes <= _Size - column.StatsOffset;
+    if (column.MissingOffset != 0)
+      valid = valid && column.MissingOffset % 8 == 0 && column.MissingOffset <= _Size && missingBytes <= _Size - column.MissingOffset;
+  }
+  if (!valid) {
+    Close();
+    throw exception();
+  }
+}
+
+void CSVSidecar::Close() {
+  if (_Data != nullptr)
+    munmap((void*)_Data, _Size);
+  _Data = nullptr;
+  _Size = 0;
+  _Header = nullptr;
+  _Columns = nullptr;
+}
+
+int CSVSidecar::Find(string_view name) const {
+  for (size_t c = 0; c < ColumnCount(); c++) {
+    if (Name(c) == name)
+      return (int)c;
+  }
+  return -1;
+}
+
+}
+}
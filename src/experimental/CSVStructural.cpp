@@ -0,0 +1,77 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+
+#include <seLib/experimental/CSVStructural.h>
+
+namespace seLib {
+namespace CSVFile {
+
+using namespace std;
+
+static inline void Flatten(uint64_t bits, uint32_t base, uint32_t*& out) {
+  // Write four positions per step whether or not they are all valid; the
+  // caller leaves room for a whole block.
+  while (bits != 0) {
+    out[0] = base + (uint32_t)__builtin_ctzll(bits);
+    bits &= bits - 1;
+    out[1] = base + (uint32_t)__builtin_ctzll(bits | (1ULL << 63));
+    bits &= bits - 1;
+    out[2] = base + (uint32_t)__builtin_ctzll(bits | (1ULL << 63));
+    bits &= bits - 1;
+    out[3] = base + (uint32_t)__builtin_ctzll(bits | (1ULL << 63));
+    bits &= bits - 1;
+    out += 4;
+  }
+}
+
+size_t CSVStructuralIndexer::Index(const char* data, size_t len, vector<uint32_t>& positions) {
+  // Room for every byte plus the unrolled overshoot. The vector only grows,
+  // so a reused one is not cleared or reallocated on every call.
+  if (positions.size() < len + BlockSize + 4)
+    positions.resize(len + BlockSize + 4);
+  uint32_t* begin = positions.data();
+  uint32_t* out = begin;
+  CSVBlockMasks masks;
+
+  size_t offset = 0;
+  for (; offset + BlockSize <= len; offset += BlockSize) {
+    Classify(data + offset, Separator, masks);
+    uint64_t bits = Structurals(masks);
+    uint32_t* blockout = out;
+    Flatten(bits, (uint32_t)offset, out);
+    // Flatten rounds up to four; keep only the real ones.
+    out = blockout + __builtin_popcountll(bits);
+  }
+
+  if (offset < len) {
+    // Pad the last partial block with zeros, which are never structural.
+    char block[BlockSize];
+    memset(block, 0, BlockSize);
+    memcpy(block, data + offset, len - offset);
+    Classify(block, Separator, masks);
+    uint64_t bits = Structurals(masks);
+    uint32_t* blockout = out;
+    Flatten(bits, (uint32_t)offset, out);
+    out = blockout + __builtin_popcountll(bits);
+  }
+
+  return out - begin;
+}
+
+}
+}
@@ -0,0 +1,213 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define SELIB_CRC32C_X86
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define SELIB_CRC32C_ARM
+#endif
+
+#include <seLib/experimental/Checksum.h>
+
+namespace seLib {
+namespace Checksum {
+
+//== CRC-32C ========================================================================
+
+struct Crc32cTables {
+    uint32_t Table[8][256];
+
+    constexpr Crc32cTables() : Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+            Table[0][i] = crc;
+        }
+        for (int k = 1; k < 8; k++) {
+            for (uint32_t i = 0; i < 256; i++)
+                Table[k][i] = (Table[k - 1][i] >> 8) ^ Table[0][Table[k - 1][i] & 0xFF];
+        }
+    }
+};
+
+static constexpr Crc32cTables crc32c_tables;
+
+uint32_t Crc32cSoftware(const uint8_t* data, size_t len, uint32_t crc) {
+    auto& t = crc32c_tables.Table;
+    crc = ~crc;
+
+    while (len >= 8) {
+        uint32_t lo = LoadLE32(data) ^ crc;
+        uint32_t hi = LoadLE32(data + 4);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        data += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+        data++;
+        len--;
+    }
+
+    return ~crc;
+}
+
+#if defined(SELIB_CRC32C_X86)
+
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cX86(const uint8_t* data, size_t len, uint32_t crc) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4) {
+        uint32_t value;
+        memcpy(&value, data, 4);
+        crc = _mm_crc32_u32(crc, value);
+        data += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *data);
+        data++;
+        len--;
+    }
+    return ~crc;
+}
+
+static const bool crc32c_hardware = __builtin_cpu_supports("sse4.2");
+
+#elif defined(SELIB_CRC32C_ARM)
+
+static uint32_t Crc32cArm(const uint8_t* data, size_t len, uint32_t crc) {
+    crc = ~crc;
+    while (len >= 8) {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc = __crc32cd(crc, value);
+        data += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = __crc32cb(crc, *data);
+        data++;
+        len--;
+    }
+    return ~crc;
+}
+
+static const bool crc32c_hardware = true;
+
+#else
+
+static const bool crc32c_hardware = false;
+
+#endif
+
+uint32_t Crc32c(const uint8_t* data, size_t len, uint32_t crc) {
+#if defined(SELIB_CRC32C_X86)
+    if (crc32c_hardware)
+        return Crc32cX86(data, len, crc);
+#elif defined(SELIB_CRC32C_ARM)
+    return Crc32cArm(data, len, crc);
+#endif
+    return Crc32cSoftware(data, len, crc);
+}
+
+bool Crc32cHardware() {
+    return crc32c_hardware;
+}
+
+//== Adler / Fletcher ========================================================================
+
+uint32_t Adler32(const uint8_t* data, size_t len, uint32_t adler) {
+    // largest block for which the sums cannot overflow 32 bits before reduction
+    const size_t nmax = 5552;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (len > 0) {
+        size_t block = (len < nmax) ? len : nmax;
+        len -= block;
+        while (block-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+uint16_t Fletcher16(const uint8_t* data, size_t len, uint16_t sum) {
+    uint32_t a = sum & 0xFF;
+    uint32_t b = sum >> 8;
+
+    while (len > 0) {
+        size_t block = (len < 5802) ? len : 5802;
+        len -= block;
+        while (block-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= 255;
+        b %= 255;
+    }
+
+    return (uint16_t)((b << 8) | a);
+}
+
+uint32_t Fletcher32(const uint8_t* data, size_t len, uint32_t sum) {
+    uint32_t a = sum & 0xFFFF;
+    uint32_t b = sum >> 16;
+    size_t words = len >> 1;
+
+    while (words > 0) {
+        size_t block = (words < 359) ? words : 359;
+        words -= block;
+        while (block-- > 0) {
+            a += data[0] | (data[1] << 8);
+            b += a;
+            data += 2;
+        }
+        a %= 65535;
+        b %= 65535;
+    }
+    if (len & 1) {
+        a = (a + *data) % 65535;
+        b = (b + a) % 65535;
+    }
+
+    return (b << 16) | a;
+}
+
+}
+}
@@ -0,0 +1,322 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include <algorithm>
+#include <exception>
+
+#include <seLib/experimental/PacketStreamAsync.h>
+
+namespace seLib {
+
+using namespace std;
+
+//== Worker pool ========================================================================
+
+PacketStreamWorkerPool::PacketStreamWorkerPool(unsigned threadcount) {
+    if (threadcount == 0)
+        threadcount = 1;
+    _Running = true;
+    for (unsigned i = 0; i < threadcount; i++)
+        _Workers.emplace_back(new Worker());
+    for (size_t i = 0; i < _Workers.size(); i++)
+        _Workers[i]->Thread = thread(&PacketStreamWorkerPool::WorkerMain, this, i);
+}
+
+PacketStreamWorkerPool::~PacketStreamWorkerPool() {
+    Stop();
+}
+
+void PacketStreamWorkerPool::Stop() {
+    {
+        lock_guard<mutex> lock(_Lock);
+        if (!_Running)
+            return;
+        _Running = false;
+    }
+    _Wake.notify_all();
+    for (auto& worker : _Workers) {
+        if (worker->Thread.joinable())
+            worker->Thread.join();
+    }
+}
+
+void PacketStreamWorkerPool::Attach(AsyncPacketStreamQueue* queue) {
+    lock_guard<mutex> lock(_Lock);
+    _Queues.push_back(queue);
+    _Version++;
+}
+
+void PacketStreamWorkerPool::Detach(AsyncPacketStreamQueue* queue) {
+    uint64_t version;
+    {
+        lock_guard<mutex> lock(_Lock);
+        _Queues.erase(remove(_Queues.begin(), _Queues.end(), queue), _Queues.end());
+        version = ++_Version;
+    }
+
+    // wait until no worker is still scanning with a registry copy that
+    // includes the detached queue
+    for (auto& worker : _Workers) {
+        for (;;) {
+            uint64_t seen = worker->SeenVersion.load();
+            if (seen == UINT64_MAX || seen >= version)
+                break;
+            this_thread::yield();
+        }
+    }
+}
+
+// Deliver up to DrainBatch entries of a queue. Statistics are a template
+// parameter, so the loop for a queue without them has no statistics code.
+template <bool Stats_T>
+size_t PacketStreamWorkerPool::DrainEntries(AsyncPacketStreamQueue& queue) {
+    const PacketStreamDescriptor& descriptor = *queue.Descriptor;
+    const PacketStreamReceiver& receiver = queue.Receiver;
+    size_t count = 0;
+    AsyncPacketStreamEntry entry;
+    while (count < queue.DrainBatch && queue.Queue.TryPop(entry)) {
+        const uint8_t* packet = entry.Data;
+        PacketStreamStats::Clock::time_point start;
+        if constexpr (Stats_T) {
+            start = PacketStreamStats::Clock::now();
+            queue.Stats->RecordQueueLatency((uint64_t)chrono::duration_cast<chrono::nanoseconds>(start - entry.Queued).count());
+            queue.Stats->RecordQueueDepth(queue.Queue.size());
+        }
+        if (receiver.batchcallback != nullptr) {
+            receiver.batchcallback(descriptor, packet, entry.Count, receiver.reference);
+        } else {
+            for (size_t n = 0; n < entry.Count; n++, packet += descriptor.PacketSize)
+                receiver.callback(descriptor, packet, receiver.reference);
+        }
+        if constexpr (Stats_T) {
+            auto elapsed = chrono::duration_cast<chrono::nanoseconds>(PacketStreamStats::Clock::now() - start);
+            queue.Stats->RecordCall(entry.Count, entry.Count * descriptor.PacketSize, (uint64_t)elapsed.count());
+        }
+        entry.Buffer->Release();
+        count++;
+    }
+    return count;
+}
+
+size_t PacketStreamWorkerPool::Drain(AsyncPacketStreamQueue* queue) {
+    bool ordered = (queue->Ordering == PacketStreamOrdering::PerReceiver);
+    if (ordered && queue->Draining.exchange(true, memory_order_acquire))
+        return 0; // another worker owns this receiver
+
+    size_t count = (queue->Stats != nullptr) ? DrainEntries<true>(*queue) : DrainEntries<false>(*queue);
+
+    if (ordered)
+        queue->Draining.store(false, memory_order_release);
+    return count;
+}
+
+void PacketStreamWorkerPool::WorkerMain(size_t index) {
+    Worker& self = *_Workers[index];
+    vector<AsyncPacketStreamQueue*> queues;
+    uint64_t version = UINT64_MAX;
+    unsigned idle = 0;
+
+    while (_Running.load(memory_order_relaxed)) {
+        if (version != _Version.load()) {
+            lock_guard<mutex> lock(_Lock);
+            queues = _Queues;
+            version = _Version;
+            self.SeenVersion = version;
+        }
+
+        // start at a different queue in each worker to spread the load
+        uint64_t signals = _Signals.load();
+        size_t delivered = 0;
+        size_t queuecount = queues.size();
+        for (size_t i = 0; i < queuecount; i++)
+            delivered += Drain(queues[(i + index) % queuecount]);
+        if (delivered > 0) {
+            idle = 0;
+            continue;
+        }
+        // Poll a while before sleeping, so a steady producer does not pay
+        // for a wake per packet.
+        if (++idle < IdlePolls) {
+            this_thread::yield();
+            continue;
+        }
+        idle = 0;
+
+        unique_lock<mutex> lock(_Lock);
+        _Sleeping++;
+        self.SeenVersion = UINT64_MAX;
+        _Wake.wait(lock, [this, signals]() { return _Signals.load() != signals || !_Running; });
+        _Sleeping--;
+        queues = _Queues;
+        version = _Version;
+        self.SeenVersion = version;
+    }
+
+    self.SeenVersion = UINT64_MAX;
+}
+
+//== Async stream ========================================================================
+
+AsyncPacketStream::AsyncPacketStream(const PacketStreamDescriptor& descriptor, PacketStreamWorkerPool& pool, const AsyncPacketStreamOptions& options) :
+    _Descriptor(descriptor), _Pool(pool), _Options(options), _PacketPool(options.Pool)
+{
+    if (_PacketPool == nullptr && descriptor.ReceiverCount > 0) {
+        // Every live slot is held by a queue entry or by a worker delivering
+        // one, so the pool only runs dry when the queues are full.
+        size_t slots = options.QueueSize * descriptor.ReceiverCount + pool.ThreadCount();
+        _OwnedPool.reset(new PacketStreamPool(descriptor.PacketSize, slots, options.SlotPackets));
+        _PacketPool = _OwnedPool.get();
+    }
+    if (_PacketPool != nullptr) {
+        _SlotPackets = _PacketPool->PacketSize() * _PacketPool->SlotPackets() / descriptor.PacketSize;
+        if (_SlotPackets == 0)
+            throw exception();
+    }
+    for (int i = 0; i < descriptor.ReceiverCount; i++)
+        _Queues.emplace_back(new AsyncPacketStreamQueue(&descriptor, descriptor.Receivers[i], options));
+    for (auto& queue : _Queues) {
+        if (queue->Stats != nullptr)
+            _Timed = true;
+        _Pool.Attach(queue.get());
+    }
+}
+
+AsyncPacketStream::~AsyncPacketStream() {
+    for (auto& queue : _Queues) {
+        _Pool.Detach(queue.get());
+
+        AsyncPacketStreamEntry entry;
+        while (queue->Queue.TryPop(entry))
+            entry.Buffer->Release();
+    }
+}
+
+template <bool Stats_T>
+bool AsyncPacketStream::Push(AsyncPacketStreamQueue& queue, const AsyncPacketStreamEntry& entry) {
+    // With Stats_T, some queues of the stream may still have none.
+    PacketStreamStats* stats = Stats_T ? queue.Stats : nullptr;
+    entry.Buffer->Subscribe();
+    while (!queue.Queue.TryPush(entry)) {
+        AsyncPacketStreamEntry oldest;
+        switch (_Options.Overflow) {
+        case PacketStreamOverflow::DropOldest:
+            if (queue.Queue.TryPop(oldest)) {
+                oldest.Buffer->Release();
+                queue.Dropped.fetch_add(oldest.Count, memory_order_relaxed);
+                if (Stats_T && stats != nullptr)
+                    stats->RecordDrops(oldest.Count);
+            }
+            break;
+        case PacketStreamOverflow::Block:
+            this_thread::yield();
+            break;
+        case PacketStreamOverflow::CountAndDrop:
+            queue.Dropped.fetch_add(entry.Count, memory_order_relaxed);
+            if (Stats_T && stats != nullptr)
+                stats->RecordDrops(entry.Count);
+            entry.Buffer->Release();
+            return false;
+        }
+    }
+    if (Stats_T && stats != nullptr)
+        stats->RecordQueueDepth(queue.Queue.size());
+    return true;
+}
+
+void AsyncPacketStream::Enqueue(RefBuffer* buffer, size_t count, const uint8_t* packetdata) {
+    AsyncPacketStreamEntry entry;
+    entry.Buffer = buffer;
+    entry.Data = packetdata;
+    entry.Count = count;
+    bool queued = false;
+    if (_Timed) {
+        entry.Queued = PacketStreamStats::Clock::now();
+        for (auto& queue : _Queues)
+            queued |= Push<true>(*queue, entry);
+    } else {
+        for (auto& queue : _Queues)
+            queued |= Push<false>(*queue, entry);
+    }
+    if (queued)
+        _Pool.Signal();
+}
+
+void AsyncPacketStream::NotifyBatch(RefBuffer* buffer, size_t count, const uint8_t* packetdata) {
+    buffer->Subscribe(); // hold the buffer until every queue has its own reference
+    Enqueue(buffer, count, (packetdata != nullptr) ? packetdata : **buffer);
+    buffer->Release();
+}
+
+// Count a run that could not be queued for lack of a pool slot.
+void AsyncPacketStream::Drop(size_t count) {
+    for (auto& queue : _Queues) {
+        queue->Dropped.fetch_add(count, memory_order_relaxed);
+        if (queue->Stats != nullptr)
+            queue->Stats->RecordDrops(count);
+    }
+}
+
+void AsyncPacketStream::NotifyBatch(const void* buffer, size_t count) {
+    if (_Queues.empty() || count == 0)
+        return;
+    size_t packetsize = _Descriptor.PacketSize;
+    PacketStreamPool& pool = *_PacketPool;
+
+    // zero copy when the packets already live in a pool slot
+    RefBuffer* slot = pool.Find(buffer);
+    if (slot != nullptr && (const uint8_t*)buffer + packetsize * count <= **slot + slot->size()) {
+        NotifyBatch(slot, count, (const uint8_t*)buffer);
+        return;
+    }
+
+    const uint8_t* packet = (const uint8_t*)buffer;
+    while (count > 0) {
+        size_t run = min(count, _SlotPackets);
+        RefBufferView view = pool.Acquire();
+        while (view.size() == 0 && _Options.Overflow == PacketStreamOverflow::Block) {
+            this_thread::yield();
+            view = pool.Acquire();
+        }
+        if (view.size() == 0) {
+            Drop(run);
+        } else {
+            // The view holds the slot while it is queued.
+            memcpy(*view, packet, packetsize * run);
+            Enqueue(pool.Find(*view), run, *view);
+        }
+        packet += packetsize * run;
+        count -= run;
+    }
+}
+
+void AsyncPacketStream::Notify(RefBuffer* buffer) {
+    NotifyBatch(buffer, 1);
+}
+
+void AsyncPacketStream::Notify(const void* buffer) {
+    NotifyBatch(buffer, 1);
+}
+
+void AsyncPacketStream::Callback(const PacketStreamDescriptor& /*descriptor*/, const uint8_t* packetdata, void* reference) {
+    ((AsyncPacketStream*)reference)->NotifyBatch((const void*)packetdata, 1);
+}
+
+void AsyncPacketStream::BatchCallback(const PacketStreamDescriptor& /*descriptor*/, const uint8_t* packetdata, size_t packetcount, void* reference) {
+    ((AsyncPacketStream*)reference)->NotifyBatch((const void*)packetdata, packetcount);
+}
+
+}
@@ -0,0 +1,238 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include <algorithm>
+
+#include <seLib/experimental/Checksum.h>
+#include <seLib/experimental/PacketStreamFraming.h>
+
+namespace seLib {
+
+using namespace std;
+
+void PacketFrameDecoder::Deliver(const uint8_t* frame, size_t len, bool verified) {
+    if (Integrity == PacketFrameIntegrity::Crc32c) {
+        if (len < 4) {
+            Stats.LengthErrors++;
+            return;
+        }
+        if (!verified && Checksum::Crc32c(frame, len) != Checksum::Crc32cResidue) {
+            Stats.ChecksumErrors++;
+            return;
+        }
+        len -= 4;
+    }
+
+    size_t typelen = _Router.TypeFieldSize;
+    if (len < typelen) {
+        Stats.LengthErrors++;
+        return;
+    }
+    const PacketStreamDescriptor* descriptor = _Router.Find(_Router.ReadType(frame));
+    if (descriptor == nullptr) {
+        Stats.UnknownTypes++;
+        return;
+    }
+    if (len - typelen != descriptor->PacketSize) {
+        Stats.LengthErrors++;
+        return;
+    }
+    descriptor->Notify(frame + typelen);
+    Stats.Frames++;
+}
+
+//== COBS ========================================================================
+
+size_t COBSFrameDecoder::DecodeInPlace(uint8_t* frame, size_t len, uint32_t* crc) {
+    static const uint8_t zero = 0;
+    size_t read = 0;
+    size_t write = 0;
+    while (read < len) {
+        uint8_t code = frame[read++];
+        if (code == 0)
+            return SIZE_MAX;
+        size_t run = code - 1;
+        if (read + run > len)
+            return SIZE_MAX;
+        memmove(frame + write, frame + read, run);
+        if (crc != nullptr)
+            *crc = Checksum::Crc32c(frame + write, run, *crc);
+        write += run;
+        read += run;
+        if (code != 0xFF && read < len) {
+            frame[write++] = 0;
+            if (crc != nullptr)
+                *crc = Checksum::Crc32c(&zero, 1, *crc);
+        }
+    }
+    return write;
+}
+
+size_t COBSFrameDecoder::Encode(const uint8_t* data, size_t len, uint8_t* out) {
+    size_t write = 1;
+    size_t codepos = 0;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == 0) {
+            out[codepos] = code;
+            codepos = write++;
+            code = 1;
+            continue;
+        }
+        out[write++] = data[i];
+        if (++code == 0xFF) {
+            out[codepos] = code;
+            codepos = write++;
+            code = 1;
+        }
+    }
+    out[codepos] = code;
+    out[write++] = 0;
+    return write;
+}
+
+void COBSFrameDecoder::DecodeFrame(uint8_t* frame, size_t len) {
+    if (len == 0)
+        return; // back to back delimiters, used for resynchronization
+    bool check = (Integrity == PacketFrameIntegrity::Crc32c);
+    uint32_t crc = 0;
+    size_t decoded = DecodeInPlace(frame, len, check ? &crc : nullptr);
+    if (decoded == SIZE_MAX) {
+        Stats.FramingErrors++;
+        return;
+    }
+    if (check && decoded >= 4 && crc != Checksum::Crc32cResidue) {
+        Stats.ChecksumErrors++;
+        return;
+    }
+    Deliver(frame, decoded, check);
+}
+
+void COBSFrameDecoder::Decode(uint8_t* data, size_t len) {
+    uint8_t* end = data + len;
+
+    // finish a frame started in an earlier buffer
+    if (!_Partial.empty() || _Discarding) {
+        size_t pos = FindByte(data, len, 0);
+        if (!_Discarding) {
+            if (_Partial.size() + pos > MaxFrameSize) {
+                Stats.Overruns++;
+                _Partial.clear();
+                _Discarding = true;
+            } else {
+                _Partial.insert(_Partial.end(), data, data + pos);
+            }
+        }
+        if (pos == len)
+            return;
+        if (!_Discarding)
+            DecodeFrame(_Partial.data(), _Partial.size());
+        _Partial.clear();
+        _Discarding = false;
+        data += pos + 1;
+    }
+
+    while (data < end) {
+        size_t remaining = end - data;
+        size_t pos = FindByte(data, remaining, 0);
+        if (pos == remaining) {
+            if (remaining > MaxFrameSize) {
+                Stats.Overruns++;
+                _Discarding = true;
+            } else {
+                _Partial.assign(data, end);
+            }
+            return;
+        }
+        if (pos > MaxFrameSize)
+            Stats.Overruns++;
+        else
+            DecodeFrame(data, pos);
+        data += pos + 1;
+    }
+}
+
+//== Length prefix ========================================================================
+
+size_t LengthPrefixFrameDecoder::Encode(const uint8_t* data, size_t len, uint8_t* out) {
+    out[0] = (uint8_t)(len & 0xFF);
+    out[1] = (uint8_t)((len >> 8) & 0xFF);
+    memcpy(out + HeaderSize, data, len);
+    return HeaderSize + len;
+}
+
+void LengthPrefixFrameDecoder::Decode(uint8_t* data, size_t len) {
+    uint8_t* end = data + len;
+
+    // skip the rest of an oversized frame
+    size_t skip = min(_Skip, len);
+    data += skip;
+    _Skip -= skip;
+
+    // finish a header or frame started in an earlier buffer
+    while (!_Partial.empty() && data < end) {
+        size_t needed = HeaderSize;
+        if (_Partial.size() >= HeaderSize)
+            needed += FrameLength(_Partial.data());
+        size_t take = min(needed - _Partial.size(), (size_t)(end - data));
+        _Partial.insert(_Partial.end(), data, data + take);
+        data += take;
+        if (_Partial.size() < needed)
+            return;
+
+        if (needed == HeaderSize) {
+            // header complete, frame still to come
+            size_t framelen = FrameLength(_Partial.data());
+            if (framelen > MaxFrameSize) {
+                Stats.Overruns++;
+                _Partial.clear();
+                skip = min(framelen, (size_t)(end - data));
+                data += skip;
+                _Skip = framelen - skip;
+                continue;
+            }
+            if (framelen > 0)
+                continue;
+        }
+        Deliver(_Partial.data() + HeaderSize, needed - HeaderSize);
+        _Partial.clear();
+    }
+
+    while (data < end) {
+        size_t remaining = end - data;
+        if (remaining < HeaderSize) {
+            _Partial.assign(data, end);
+            return;
+        }
+        size_t framelen = FrameLength(data);
+        if (framelen > MaxFrameSize) {
+            Stats.Overruns++;
+            skip = min(framelen, remaining - HeaderSize);
+            data += HeaderSize + skip;
+            _Skip = framelen - skip;
+            continue;
+        }
+        if (remaining < HeaderSize + framelen) {
+            _Partial.assign(data, end);
+            return;
+        }
+        Deliver(data + HeaderSize, framelen);
+        data += HeaderSize + framelen;
+    }
+}
+
+}
@@ -0,0 +1,267 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include <exception>
+#include <thread>
+
+#include <seLib/experimental/PacketStreamMerge.h>
+
+namespace seLib {
+
+using namespace std;
+
+static size_t RoundQueueSize(size_t size) {
+    size_t rounded = 2;
+    while (rounded < size)
+        rounded <<= 1;
+    return rounded;
+}
+
+PacketStreamMerge::PacketStreamMerge(const PacketStreamDescriptor& output, PacketTimestampFunction timestamp, size_t sourcecount,
+    const PacketStreamMergeOptions& options) :
+    _Output(output), _Timestamp(timestamp), _Options(options), _Mask(RoundQueueSize(options.QueueSize) - 1)
+{
+    if (sourcecount == 0 || timestamp == nullptr || output.PacketSize == 0)
+        throw exception();
+
+    for (size_t i = 0; i < sourcecount; i++) {
+        unique_ptr<Source> source(new Source());
+        source->Merge = this;
+        source->Index = i;
+        source->Packets.reset(new uint8_t[(_Mask + 1) * output.PacketSize]);
+        source->Timestamps.reset(new int64_t[_Mask + 1]);
+        _Sources.push_back(move(source));
+    }
+
+    _Leaves = 1;
+    while (_Leaves < sourcecount)
+        _Leaves <<= 1;
+    _Tree.assign(_Leaves, 0);
+    _Winners.assign(2 * _Leaves, 0);
+    _Keys.assign(_Leaves, INT64_MAX);
+    _Heads.assign(sourcecount, 0);
+    _Lasts.assign(sourcecount, INT64_MIN);
+}
+
+//== Sources ========================================================================
+
+bool PacketStreamMerge::Push(size_t index, const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount) {
+    Source& source = *_Sources[index];
+    size_t packetsize = _Output.PacketSize;
+    uint64_t head = source.Head.load(memory_order_relaxed);
+    uint64_t tail = source.Tail.load(memory_order_acquire);
+    int64_t last = source.Last.load(memory_order_relaxed);
+    bool complete = true;
+
+    for (size_t i = 0; i < packetcount; i++) {
+        while (head - tail > _Mask) {
+            if (!_Options.Block)
+                break;
+            // Publish what we have so the merge can make room.
+            source.Head.store(head, memory_order_release);
+            this_thread::yield();
+            tail = source.Tail.load(memory_order_acquire);
+        }
+        if (head - tail > _Mask) {
+            source.Drops.fetch_add(packetcount - i, memory_order_relaxed);
+            complete = false;
+            break;
+        }
+
+        const uint8_t* packet = packetdata + i * packetsize;
+        size_t slot = (size_t)(head & _Mask);
+        int64_t timestamp = _Timestamp(descriptor, packet);
+        memcpy(source.Packets.get() + slot * packetsize, packet, packetsize);
+        source.Timestamps[slot] = timestamp;
+        if (timestamp > last)
+            last = timestamp;
+        head++;
+    }
+
+    // Publish the packets before the timestamp that covers them, so the merge
+    // never sees a Last that is ahead of the queue it read afterwards.
+    source.Head.store(head, memory_order_release);
+    source.Last.store(last, memory_order_release);
+    return complete;
+}
+
+void PacketStreamMerge::Callback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference) {
+    Source* source = (Source*)reference;
+    if (descriptor.PacketSize != source->Merge->_Output.PacketSize) {
+        source->LengthErrors.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    source->Merge->Push(source->Index, descriptor, packetdata, 1);
+}
+
+void PacketStreamMerge::BatchCallback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference) {
+    Source* source = (Source*)reference;
+    if (descriptor.PacketSize != source->Merge->_Output.PacketSize) {
+        source->LengthErrors.fetch_add(packetcount, memory_order_relaxed);
+        return;
+    }
+    source->Merge->Push(source->Index, descriptor, packetdata, packetcount);
+}
+
+//== Loser tree ========================================================================
+
+void PacketStreamMerge::Build() {
+    vector<size_t>& winners = _Winners;
+    for (size_t i = 0; i < _Leaves; i++)
+        winners[_Leaves + i] = i;
+    for (size_t node = _Leaves - 1; node > 0; node--) {
+        size_t a = winners[2 * node];
+        size_t b = winners[2 * node + 1];
+        bool aWins = Less(a, b);
+        winners[node] = aWins ? a : b;
+        _Tree[node] = aWins ? b : a;
+    }
+    _Tree[0] = (_Leaves > 1) ? winners[1] : 0;
+}
+
+void PacketStreamMerge::Replay(size_t leaf) {
+    size_t winner = leaf;
+    for (size_t node = (leaf + _Leaves) / 2; node > 0; node /= 2) {
+        if (Less(_Tree[node], winner))
+            swap(_Tree[node], winner);
+    }
+    _Tree[0] = winner;
+}
+
+// Earliest key among the sources other than the winner: the best of the
+// losers along the winner's path.
+int64_t PacketStreamMerge::RunnerUp() const {
+    int64_t best = INT64_MAX;
+    for (size_t node = (_Tree[0] + _Leaves) / 2; node > 0; node /= 2) {
+        if (_Keys[_Tree[node]] < best)
+            best = _Keys[_Tree[node]];
+    }
+    return best;
+}
+
+//== Merge ========================================================================
+
+void PacketStreamMerge::Deliver(const uint8_t* packetdata, size_t packetcount) {
+    if (packetcount == 1)
+        _Output.Notify(packetdata);
+    else if (packetcount > 1)
+        _Output.NotifyBatch(packetdata, packetcount);
+    Packets += packetcount;
+}
+
+size_t PacketStreamMerge::Pump(size_t maxpackets, bool flush) {
+    size_t packetsize = _Output.PacketSize;
+    size_t sourcecount = _Sources.size();
+
+    // Snapshot the queues. An empty source bounds what may be emitted by the
+    // last timestamp it has seen, since its later packets cannot be earlier.
+    vector<uint64_t>& heads = _Heads;
+    vector<int64_t>& lasts = _Lasts;
+    int64_t latest = INT64_MIN;
+    int64_t emptybound = INT64_MAX;
+    for (size_t i = 0; i < sourcecount; i++) {
+        Source& source = *_Sources[i];
+        int64_t last = source.Last.load(memory_order_acquire);
+        lasts[i] = last;
+        heads[i] = source.Head.load(memory_order_acquire);
+        uint64_t tail = source.Tail.load(memory_order_relaxed);
+        if (last > latest)
+            latest = last;
+        if (heads[i] != tail) {
+            _Keys[i] = source.Timestamps[tail & _Mask];
+        } else {
+            _Keys[i] = INT64_MAX;
+            if (last < emptybound)
+                emptybound = last;
+        }
+    }
+
+    int64_t lateness = (latest > INT64_MIN + _Options.Lateness) ? latest - _Options.Lateness : INT64_MIN;
+    int64_t limit = flush ? INT64_MAX : max(emptybound, lateness);
+
+    Build();
+
+    size_t delivered = 0;
+    while (delivered < maxpackets) {
+        size_t winner = _Tree[0];
+        int64_t key = _Keys[winner];
+        if (key == INT64_MAX || key > limit)
+            break;
+
+        // Take a run from the winning source while it stays ahead of every
+        // other source, and deliver it in one batch.
+        Source& source = *_Sources[winner];
+        int64_t runbound = min(RunnerUp(), limit);
+        uint64_t tail = source.Tail.load(memory_order_relaxed);
+        size_t maxrun = min(_Options.BatchSize, maxpackets - delivered);
+        const uint8_t* run = source.Packets.get() + (tail & _Mask) * packetsize;
+        size_t runlength = 0;
+
+        do {
+            int64_t timestamp = source.Timestamps[tail & _Mask];
+            if (timestamp < _LastEmitted) {
+                Late++;
+                if (_Options.DropLate) {
+                    // Deliver the packets before it and end the run, so the
+                    // run never exceeds maxrun.
+                    Deliver(run, runlength);
+                    delivered += runlength;
+                    LateDropped++;
+                    tail++;
+                    runlength = 0;
+                    break;
+                }
+            } else {
+                _LastEmitted = timestamp;
+            }
+            runlength++;
+            tail++;
+        } while (tail != heads[winner] && runlength < maxrun && (tail & _Mask) != 0 &&
+            source.Timestamps[tail & _Mask] <= runbound);
+
+        Deliver(run, runlength);
+        delivered += runlength;
+        source.Tail.store(tail, memory_order_release);
+
+        if (tail != heads[winner]) {
+            _Keys[winner] = source.Timestamps[tail & _Mask];
+        } else {
+            _Keys[winner] = INT64_MAX;
+            if (!flush)
+                limit = min(limit, max(lasts[winner], lateness));
+        }
+        Replay(winner);
+    }
+
+    return delivered;
+}
+
+void PacketStreamMerge::Run(const atomic<bool>& running) {
+    unsigned idle = 0;
+    while (running.load(memory_order_relaxed)) {
+        if (Pump() > 0) {
+            idle = 0;
+        } else if (++idle < 64) {
+            this_thread::yield();
+        } else {
+            this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+    Pump(SIZE_MAX, true);
+}
+
+}
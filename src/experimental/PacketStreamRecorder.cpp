@@ -0,0 +1,310 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <exception>
+#include <thread>
+
+#include <seLib/experimental/PacketStreamRecorder.h>
+
+namespace seLib {
+
+using namespace std;
+
+//== PacketStreamRecorder ========================================================================
+
+PacketStreamRecorder::PacketStreamRecorder(const string& path, size_t buffersize, size_t indexinterval) :
+    IndexInterval((indexinterval > 0) ? indexinterval : 1)
+{
+    _Fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_Fd < 0)
+        throw exception();
+    _Buffer.resize((buffersize > 4096) ? buffersize : 4096);
+
+    PacketRecordFileHeader header = { PacketRecordFileHeader::MagicValue, PacketRecordFileHeader::VersionValue, 0 };
+    memcpy(_Buffer.data(), &header, sizeof(header));
+    _Used = sizeof(header);
+}
+
+PacketStreamRecorder::~PacketStreamRecorder() {
+    // A failed write must not escape a destructor; the file is left without
+    // its index and can still be scanned.
+    try {
+        Close();
+    } catch (...) {
+        if (_Fd >= 0)
+            close(_Fd);
+    }
+}
+
+void PacketStreamRecorder::WriteAll(const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t written = write(_Fd, p, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw exception();
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+}
+
+void PacketStreamRecorder::WriteBuffer() {
+    WriteAll(_Buffer.data(), _Used);
+    _Offset += _Used;
+    _Used = 0;
+}
+
+void PacketStreamRecorder::Append(int packettype, const void* packetdata, size_t len, int64_t timestamp) {
+    size_t record = PacketRecordSize(len);
+
+    if (_Records % IndexInterval == 0)
+        _Index.push_back(PacketRecordIndexEntry { timestamp, _Offset + _Used });
+    _Records++;
+
+    PacketRecordHeader header = { timestamp, (int32_t)packettype, (uint32_t)len };
+    if (record > _Buffer.size() - _Used) {
+        WriteBuffer();
+        if (record > _Buffer.size()) {
+            // Larger than the whole buffer: write it straight through.
+            static const uint8_t padding[PacketRecordAlignment] = {};
+            WriteAll(&header, sizeof(header));
+            WriteAll(packetdata, len);
+            WriteAll(padding, record - sizeof(header) - len);
+            _Offset += record;
+            return;
+        }
+    }
+
+    uint8_t* out = _Buffer.data() + _Used;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), packetdata, len);
+    memset(out + sizeof(header) + len, 0, record - sizeof(header) - len);
+    _Used += record;
+}
+
+void PacketStreamRecorder::Record(int packettype, const void* packetdata, size_t len, int64_t timestamp) {
+    lock_guard<mutex> lock(_Lock);
+    if (_Fd < 0)
+        throw exception();
+    Append(packettype, packetdata, len, timestamp);
+}
+
+void PacketStreamRecorder::Record(int packettype, const void* packetdata, size_t len) {
+    lock_guard<mutex> lock(_Lock);
+    if (_Fd < 0)
+        throw exception();
+    Append(packettype, packetdata, len, Now());
+}
+
+void PacketStreamRecorder::Flush() {
+    lock_guard<mutex> lock(_Lock);
+    if (_Fd >= 0)
+        WriteBuffer();
+}
+
+void PacketStreamRecorder::Close() {
+    lock_guard<mutex> lock(_Lock);
+    if (_Fd < 0)
+        return;
+
+    WriteBuffer();
+
+    PacketRecordFileTrailer trailer;
+    trailer.IndexOffset = _Offset;
+    trailer.IndexCount = _Index.size();
+    trailer.RecordCount = _Records;
+    trailer.IndexInterval = (uint32_t)IndexInterval;
+    trailer.Magic = PacketRecordFileTrailer::MagicValue;
+    WriteAll(_Index.data(), _Index.size() * sizeof(PacketRecordIndexEntry));
+    WriteAll(&trailer, sizeof(trailer));
+
+    close(_Fd);
+    _Fd = -1;
+}
+
+void PacketStreamRecorder::Callback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference) {
+    ((PacketStreamRecorder*)reference)->Record(descriptor.PacketType, packetdata, descriptor.PacketSize);
+}
+
+void PacketStreamRecorder::BatchCallback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference) {
+    PacketStreamRecorder* recorder = (PacketStreamRecorder*)reference;
+
+    lock_guard<mutex> lock(recorder->_Lock);
+    if (recorder->_Fd < 0)
+        throw exception();
+    int64_t timestamp = Now();
+    for (size_t i = 0; i < packetcount; i++)
+        recorder->Append(descriptor.PacketType, packetdata + i * descriptor.PacketSize, descriptor.PacketSize, timestamp);
+}
+
+//== PacketStreamReplayer ========================================================================
+
+PacketStreamReplayer::PacketStreamReplayer(const string& path) {
+    _Fd = open(path.c_str(), O_RDONLY);
+    if (_Fd < 0)
+        throw exception();
+
+    struct stat st;
+    if (fstat(_Fd, &st) != 0 || (size_t)st.st_size < sizeof(PacketRecordFileHeader)) {
+        close(_Fd);
+        throw exception();
+    }
+    _MapSize = (size_t)st.st_size;
+
+    void* mapping = mmap(nullptr, _MapSize, PROT_READ, MAP_PRIVATE, _Fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(_Fd);
+        throw exception();
+    }
+    _Map = (const uint8_t*)mapping;
+    madvise(mapping, _MapSize, MADV_SEQUENTIAL);
+    madvise(mapping, _MapSize, MADV_WILLNEED);
+
+    const PacketRecordFileHeader* header = (const PacketRecordFileHeader*)_Map;
+    if (header->Magic != PacketRecordFileHeader::MagicValue || header->Version != PacketRecordFileHeader::VersionValue) {
+        munmap(mapping, _MapSize);
+        close(_Fd);
+        throw exception();
+    }
+
+    if (_MapSize >= sizeof(PacketRecordFileHeader) + sizeof(PacketRecordFileTrailer)) {
+        // A truncated file may leave the trailer unaligned.
+        PacketRecordFileTrailer trailer;
+        memcpy(&trailer, _Map + _MapSize - sizeof(trailer), sizeof(trailer));
+        size_t indexspace = _MapSize - sizeof(trailer);
+        if (trailer.Magic == PacketRecordFileTrailer::MagicValue &&
+            trailer.IndexOffset >= sizeof(PacketRecordFileHeader) && trailer.IndexOffset <= indexspace &&
+            trailer.IndexOffset % PacketRecordAlignment == 0 &&
+            trailer.IndexCount == (indexspace - trailer.IndexOffset) / sizeof(PacketRecordIndexEntry) &&
+            (indexspace - trailer.IndexOffset) % sizeof(PacketRecordIndexEntry) == 0) {
+            const PacketRecordIndexEntry* index = (const PacketRecordIndexEntry*)(_Map + trailer.IndexOffset);
+            bool valid = true;
+            for (size_t i = 0; valid && i < trailer.IndexCount; i++) {
+                valid = index[i].Offset >= sizeof(PacketRecordFileHeader) && index[i].Offset < trailer.IndexOffset &&
+                    index[i].Offset % PacketRecordAlignment == 0;
+            }
+            if (valid) {
+                _End = (size_t)trailer.IndexOffset;
+                _RecordCount = trailer.RecordCount;
+                _Index = index;
+                _IndexCount = (size_t)trailer.IndexCount;
+                return;
+            }
+        }
+    }
+
+    Scan();
+}
+
+PacketStreamReplayer::~PacketStreamReplayer() {
+    if (_Map != nullptr)
+        munmap((void*)_Map, _MapSize);
+    if (_Fd >= 0)
+        close(_Fd);
+}
+
+void PacketStreamReplayer::Scan() {
+    size_t offset = sizeof(PacketRecordFileHeader);
+    while (offset + sizeof(PacketRecordHeader) <= _MapSize) {
+        size_t record = PacketRecordSize(RecordAt(offset)->Length);
+        if (record > _MapSize - offset)
+            break;
+        offset += record;
+        _RecordCount++;
+    }
+    _End = offset;
+}
+
+size_t PacketStreamReplayer::Seek(int64_t timestamp) const {
+    size_t offset = sizeof(PacketRecordFileHeader);
+
+    if (_Index != nullptr && _IndexCount > 0) {
+        // Last index entry before the timestamp, then scan forward from it.
+        size_t lo = 0;
+        size_t hi = _IndexCount;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (_Index[mid].Timestamp < timestamp)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo > 0)
+            offset = (size_t)_Index[lo - 1].Offset;
+    }
+
+    while (offset < _End && RecordAt(offset)->Timestamp < timestamp) {
+        size_t record = PacketRecordSize(RecordAt(offset)->Length);
+        if (record > _End - offset)
+            return _End;
+        offset += record;
+    }
+    return offset;
+}
+
+PacketStreamReplayStats PacketStreamReplayer::Replay(const PacketStreamRouter& router, double speed, size_t start) const {
+    typedef chrono::steady_clock Clock;
+    PacketStreamReplayStats stats;
+
+    size_t offset = start;
+    int64_t first = (offset < _End) ? RecordAt(offset)->Timestamp : 0;
+    Clock::time_point begin = Clock::now();
+
+    while (offset < _End) {
+        const PacketRecordHeader* record = RecordAt(offset);
+        size_t recordsize = PacketRecordSize(record->Length);
+        // A damaged length in an indexed file: stop rather than read past
+        // the records.
+        if (recordsize > _End - offset)
+            break;
+
+        if (speed > 0) {
+            Clock::time_point due = begin + chrono::nanoseconds((int64_t)((record->Timestamp - first) / speed));
+            // Sleep through long gaps and spin through short ones, since a
+            // sleep overshoots by tens of microseconds.
+            Clock::time_point now = Clock::now();
+            if (due - now > chrono::microseconds(200))
+                this_thread::sleep_until(due - chrono::microseconds(100));
+            while (Clock::now() < due) { }
+        }
+
+        const PacketStreamDescriptor* descriptor = router.Find(record->PacketType);
+        if (descriptor == nullptr) {
+            stats.UnknownTypes++;
+        } else if (descriptor->PacketSize != record->Length) {
+            stats.LengthErrors++;
+        } else {
+            descriptor->Notify((const uint8_t*)(record + 1));
+            stats.Packets++;
+            stats.Bytes += record->Length;
+        }
+
+        offset += recordsize;
+    }
+
+    stats.Seconds = chrono::duration<double>(Clock::now() - begin).count();
+    return stats;
+}
+
+}
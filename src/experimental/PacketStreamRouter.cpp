@@ -0,0 +1,150 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <exception>
+
+#include <seLib/experimental/PacketStreamRouter.h>
+
+namespace seLib {
+
+using namespace std;
+
+PacketStreamRouter::PacketStreamRouter(size_t typefieldsize, size_t maxdensespan) :
+    TypeFieldSize(typefieldsize), MaxDenseSpan(maxdensespan)
+{
+    if (typefieldsize != 1 && typefieldsize != 2 && typefieldsize != 4)
+        throw exception();
+}
+
+void PacketStreamRouter::Register(const PacketStreamDescriptor& descriptor) {
+    for (auto d : _Descriptors) {
+        if (d->PacketType == descriptor.PacketType)
+            throw exception();
+    }
+    vector<const PacketStreamDescriptor*> descriptors(_Descriptors);
+    descriptors.push_back(&descriptor);
+    Rebuild(descriptors);
+}
+
+void PacketStreamRouter::Unregister(int packettype) {
+    for (size_t i = 0; i < _Descriptors.size(); i++) {
+        if (_Descriptors[i]->PacketType == packettype) {
+            vector<const PacketStreamDescriptor*> descriptors(_Descriptors);
+            descriptors.erase(descriptors.begin() + i);
+            Rebuild(descriptors);
+            return;
+        }
+    }
+}
+
+bool PacketStreamRouter::TryHash(const vector<const PacketStreamDescriptor*>& descriptors, vector<const PacketStreamDescriptor*>& table,
+    uint32_t multiplier, int shift)
+{
+    fill(table.begin(), table.end(), nullptr);
+    for (auto d : descriptors) {
+        size_t index = ((uint32_t)d->PacketType * multiplier) >> shift;
+        if (table[index] != nullptr)
+            return false;
+        table[index] = d;
+    }
+    return true;
+}
+
+void PacketStreamRouter::Rebuild(vector<const PacketStreamDescriptor*>& descriptors) {
+    vector<const PacketStreamDescriptor*> table;
+
+    if (descriptors.empty()) {
+        _Table.swap(table);
+        _Descriptors.swap(descriptors);
+        _Dense = true;
+        _Base = 0;
+        return;
+    }
+
+    int mintype = descriptors[0]->PacketType;
+    int maxtype = mintype;
+    for (auto d : descriptors) {
+        mintype = min(mintype, d->PacketType);
+        maxtype = max(maxtype, d->PacketType);
+    }
+
+    size_t span = (size_t)((int64_t)maxtype - mintype) + 1;
+    if (span <= MaxDenseSpan) {
+        table.assign(span, nullptr);
+        for (auto d : descriptors)
+            table[(size_t)((unsigned)d->PacketType - (unsigned)mintype)] = d;
+        _Table.swap(table);
+        _Descriptors.swap(descriptors);
+        _Dense = true;
+        _Base = mintype;
+        return;
+    }
+
+    // Sparse types: search for an odd multiplier giving a collision-free
+    // multiply-shift hash, growing the table if none is found quickly.
+    int bits = 1;
+    while (((size_t)1 << bits) < descriptors.size() * 2)
+        bits++;
+
+    uint32_t seed = 0x9E3779B9u;
+    for (; bits < 32; bits++) {
+        int shift = 32 - bits;
+        table.assign((size_t)1 << bits, nullptr);
+        for (int attempt = 0; attempt < 4096; attempt++) {
+            // xorshift sequence of candidate multipliers
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            uint32_t multiplier = seed | 1;
+            if (TryHash(descriptors, table, multiplier, shift)) {
+                _Table.swap(table);
+                _Descriptors.swap(descriptors);
+                _Dense = false;
+                _Multiplier = multiplier;
+                _Shift = shift;
+                return;
+            }
+        }
+    }
+    throw exception();
+}
+
+PacketStreamRouteResult PacketStreamRouter::RouteStream(const uint8_t* data, size_t len) const {
+    PacketStreamRouteResult result;
+    const uint8_t* end = data + len;
+
+    while ((size_t)(end - data) >= TypeFieldSize) {
+        int packettype = ReadType(data);
+        const PacketStreamDescriptor* descriptor = Find(packettype);
+        if (descriptor == nullptr) {
+            result.UnknownType = true;
+            break;
+        }
+        size_t packetlen = TypeFieldSize + descriptor->PacketSize;
+        if ((size_t)(end - data) < packetlen)
+            break;
+
+        descriptor->Notify(data + TypeFieldSize);
+        data += packetlen;
+        result.Consumed += packetlen;
+        result.Packets++;
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,349 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
+#include <exception>
+#include <new>
+
+#include <seLib/experimental/PacketStreamShm.h>
+
+namespace seLib {
+
+using namespace std;
+
+static_assert(sizeof(SharedMemoryRingHeader) <= SharedMemoryRing::DataOffset, "ring header does not fit before the data area");
+static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t) && atomic<uint32_t>::is_always_lock_free, "futex words must be plain 32-bit integers");
+static_assert(atomic<uint64_t>::is_always_lock_free, "ring positions must be lock free to be shared between processes");
+
+//== SharedMemoryRing ========================================================================
+
+SharedMemoryRing::~SharedMemoryRing() {
+    Close();
+}
+
+void SharedMemoryRing::Create(const string& name, size_t capacity) {
+    Close();
+    _Fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (_Fd < 0)
+        throw exception();
+    _Name = name;
+    _Owner = true;
+    Initialize(capacity);
+}
+
+void SharedMemoryRing::CreateAnonymous(size_t capacity) {
+    Close();
+    _Fd = (int)syscall(SYS_memfd_create, "seLib-packetstream", 0);
+    if (_Fd < 0)
+        throw exception();
+    Initialize(capacity);
+}
+
+void SharedMemoryRing::Open(const string& name) {
+    Close();
+    _Fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (_Fd < 0)
+        throw exception();
+    OpenFd(_Fd);
+}
+
+void SharedMemoryRing::OpenFd(int fd) {
+    if (fd != _Fd)
+        Close();
+    _Fd = fd;
+
+    struct stat st;
+    if (fstat(_Fd, &st) != 0 || (size_t)st.st_size <= DataOffset)
+        throw exception();
+    Map((size_t)st.st_size);
+
+    uint64_t capacity = ((volatile SharedMemoryRingHeader*)_Header)->Capacity;
+    if (_Header->Magic != SharedMemoryRingHeader::MagicValue || _Header->Version != SharedMemoryRingHeader::VersionValue ||
+        capacity == 0 || (capacity & (capacity - 1)) != 0 || capacity != _MappedSize - DataOffset)
+        throw exception();
+    _Capacity = (size_t)capacity;
+}
+
+void SharedMemoryRing::Close() {
+    if (_Header != nullptr)
+        munmap(_Header, _MappedSize);
+    if (_Fd >= 0)
+        close(_Fd);
+    if (_Owner && !_Name.empty())
+        shm_unlink(_Name.c_str());
+    _Header = nullptr;
+    _Data = nullptr;
+    _MappedSize = 0;
+    _Capacity = 0;
+    _Fd = -1;
+    _Name.clear();
+    _Owner = false;
+}
+
+void SharedMemoryRing::Initialize(size_t capacity) {
+    size_t size = 4096;
+    while (size < capacity)
+        size <<= 1;
+
+    if (ftruncate(_Fd, (off_t)(DataOffset + size)) != 0)
+        throw exception();
+    Map(DataOffset + size);
+
+    // The segment is zero filled; construct the control block in place.
+    new (_Header) SharedMemoryRingHeader();
+    _Header->Capacity = size;
+    _Capacity = size;
+    _Header->Head.store(0, memory_order_relaxed);
+    _Header->HeadSeq.store(0, memory_order_relaxed);
+    _Header->ConsumerWaiting.store(0, memory_order_relaxed);
+    _Header->Tail.store(0, memory_order_relaxed);
+    _Header->TailSeq.store(0, memory_order_relaxed);
+    _Header->ProducerWaiting.store(0, memory_order_relaxed);
+    _Header->Version = SharedMemoryRingHeader::VersionValue;
+    atomic_thread_fence(memory_order_release);
+    _Header->Magic = SharedMemoryRingHeader::MagicValue;
+}
+
+void SharedMemoryRing::Map(size_t size) {
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _Fd, 0);
+    if (mapping == MAP_FAILED)
+        throw exception();
+    _Header = (SharedMemoryRingHeader*)mapping;
+    _Data = (uint8_t*)mapping + DataOffset;
+    _MappedSize = size;
+}
+
+bool SharedMemoryRing::Wait(atomic<uint32_t>& word, uint32_t expected, int timeout_ms) {
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+    // Not FUTEX_PRIVATE_FLAG: the word is shared with another process.
+    long result = syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT, expected, (timeout_ms < 0) ? nullptr : &timeout, nullptr, 0);
+    return result == 0 || errno == EAGAIN;
+}
+
+void SharedMemoryRing::Wake(atomic<uint32_t>& word) {
+    syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+//== SharedMemoryPacketWriter ========================================================================
+
+SharedMemoryPacketWriter::SharedMemoryPacketWriter(SharedMemoryRing& ring) :
+    _Ring(ring)
+{
+    _Head = ring.Header().Head.load(memory_order_relaxed);
+    _TailCache = ring.Header().Tail.load(memory_order_acquire);
+}
+
+bool SharedMemoryPacketWriter::WaitForSpace(size_t needed) {
+    SharedMemoryRingHeader& header = _Ring.Header();
+    size_t capacity = _Ring.Capacity();
+
+    // The consumer's position is only re-read when the cached one says the
+    // ring is full, so the producer rarely touches the consumer's cache line.
+    if (_Head + needed - _TailCache <= capacity)
+        return true;
+    _TailCache = header.Tail.load(memory_order_acquire);
+    if (_Head + needed - _TailCache <= capacity)
+        return true;
+    if (!Block)
+        return false;
+
+    // Make sure the consumer can see everything written so far before waiting
+    // for it to make room.
+    if (header.Head.load(memory_order_relaxed) != _Head)
+        Publish();
+
+    while (true) {
+        uint32_t seq = header.TailSeq.load(memory_order_seq_cst);
+        header.ProducerWaiting.store(1, memory_order_seq_cst);
+        _TailCache = header.Tail.load(memory_order_seq_cst);
+        if (_Head + needed - _TailCache <= capacity)
+            break;
+        SharedMemoryRing::Wait(header.TailSeq, seq, 100);
+    }
+    header.ProducerWaiting.store(0, memory_order_relaxed);
+    return true;
+}
+
+uint8_t* SharedMemoryPacketWriter::Reserve(int packettype, size_t len) {
+    size_t capacity = _Ring.Capacity();
+    size_t record = SharedMemoryRing::RecordSize(len);
+    if (record > capacity / 2)
+        throw exception();
+
+    size_t offset = (size_t)(_Head & (capacity - 1));
+    size_t contiguous = capacity - offset;
+    size_t padding = (contiguous < record) ? contiguous : 0;
+
+    if (!WaitForSpace(padding + record)) {
+        Drops++;
+        return nullptr;
+    }
+
+    uint8_t* data = _Ring.Data();
+    if (padding > 0) {
+        // Records never wrap, so the receiver always gets a contiguous packet.
+        ((SharedMemoryRecordHeader*)(data + offset))->Length = SharedMemoryRecordHeader::PadLength;
+        _Head += padding;
+        offset = 0;
+    }
+
+    SharedMemoryRecordHeader* recordheader = (SharedMemoryRecordHeader*)(data + offset);
+    recordheader->Length = (uint32_t)len;
+    recordheader->PacketType = packettype;
+    _Reserved = record;
+    return data + offset + sizeof(SharedMemoryRecordHeader);
+}
+
+void SharedMemoryPacketWriter::Commit() {
+    _Head += _Reserved;
+    _Reserved = 0;
+    Publish();
+}
+
+void SharedMemoryPacketWriter::Publish() {
+    SharedMemoryRingHeader& header = _Ring.Header();
+    header.Head.store(_Head, memory_order_release);
+    header.HeadSeq.fetch_add(1, memory_order_seq_cst);
+    if (header.ConsumerWaiting.load(memory_order_seq_cst) != 0)
+        SharedMemoryRing::Wake(header.HeadSeq);
+}
+
+bool SharedMemoryPacketWriter::Write(int packettype, const void* packetdata, size_t len) {
+    uint8_t* target = Reserve(packettype, len);
+    if (target == nullptr)
+        return false;
+    memcpy(target, packetdata, len);
+    Commit();
+    return true;
+}
+
+void SharedMemoryPacketWriter::Callback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, void* reference) {
+    ((SharedMemoryPacketWriter*)reference)->Write(descriptor.PacketType, packetdata, descriptor.PacketSize);
+}
+
+void SharedMemoryPacketWriter::BatchCallback(const PacketStreamDescriptor& descriptor, const uint8_t* packetdata, size_t packetcount, void* reference) {
+    SharedMemoryPacketWriter* writer = (SharedMemoryPacketWriter*)reference;
+
+    // Write the whole batch before publishing, so the consumer sees it (and
+    // is woken) once.
+    for (size_t i = 0; i < packetcount; i++) {
+        uint8_t* target = writer->Reserve(descriptor.PacketType, descriptor.PacketSize);
+        if (target == nullptr)
+            break;
+        memcpy(target, packetdata + i * descriptor.PacketSize, descriptor.PacketSize);
+        writer->_Head += writer->_Reserved;
+        writer->_Reserved = 0;
+    }
+    writer->Publish();
+}
+
+//== SharedMemoryPacketReader ========================================================================
+
+SharedMemoryPacketReader::SharedMemoryPacketReader(SharedMemoryRing& ring, const PacketStreamRouter& router) :
+    _Ring(ring), _Router(router)
+{
+    _Tail = ring.Header().Tail.load(memory_order_relaxed);
+}
+
+size_t SharedMemoryPacketReader::Poll(size_t maxpackets) {
+    SharedMemoryRingHeader& header = _Ring.Header();
+    size_t capacity = _Ring.Capacity();
+    uint8_t* data = _Ring.Data();
+
+    uint64_t head = header.Head.load(memory_order_acquire);
+    size_t count = 0;
+    bool corrupt = (head - _Tail > capacity);
+
+    while (!corrupt && _Tail != head && count < maxpackets) {
+        size_t offset = (size_t)(_Tail & (capacity - 1));
+        // Copy the header once: the other process may still change it, and
+        // everything read from it is checked before it is used.
+        SharedMemoryRecordHeader record;
+        memcpy(&record, data + offset, sizeof(record));
+
+        size_t recordsize = (record.Length == SharedMemoryRecordHeader::PadLength) ? capacity - offset :
+            (record.Length <= capacity) ? SharedMemoryRing::RecordSize(record.Length) : SIZE_MAX;
+        if (recordsize > capacity - offset || recordsize > head - _Tail) {
+            corrupt = true;
+            break;
+        }
+        if (record.Length == SharedMemoryRecordHeader::PadLength) {
+            _Tail += recordsize;
+            continue;
+        }
+
+        const PacketStreamDescriptor* descriptor = _Router.Find(record.PacketType);
+        if (descriptor == nullptr)
+            UnknownTypes++;
+        else if (descriptor->PacketSize != record.Length)
+            LengthErrors++;
+        else
+            descriptor->Notify(data + offset + sizeof(SharedMemoryRecordHeader));
+
+        _Tail += recordsize;
+        count++;
+    }
+
+    if (count > 0 || _Tail != header.Tail.load(memory_order_relaxed)) {
+        // Hand the space back once for the whole batch.
+        header.Tail.store(_Tail, memory_order_release);
+        header.TailSeq.fetch_add(1, memory_order_seq_cst);
+        if (header.ProducerWaiting.load(memory_order_seq_cst) != 0)
+            SharedMemoryRing::Wake(header.TailSeq);
+        Packets += count;
+    }
+
+    // A head behind the tail or too far ahead, or a record that overruns the
+    // ring or the published data, cannot be skipped safely.
+    if (corrupt)
+        throw exception();
+    return count;
+}
+
+bool SharedMemoryPacketReader::Wait(int timeout_ms) {
+    SharedMemoryRingHeader& header = _Ring.Header();
+
+    uint32_t seq = header.HeadSeq.load(memory_order_seq_cst);
+    if (header.Head.load(memory_order_acquire) != _Tail)
+        return true;
+
+    header.ConsumerWaiting.store(1, memory_order_seq_cst);
+    if (header.Head.load(memory_order_seq_cst) == _Tail)
+        SharedMemoryRing::Wait(header.HeadSeq, seq, timeout_ms);
+    header.ConsumerWaiting.store(0, memory_order_relaxed);
+
+    return header.Head.load(memory_order_acquire) != _Tail;
+}
+
+void SharedMemoryPacketReader::Run(const atomic<bool>& running, int timeout_ms) {
+    while (running.load(memory_order_relaxed)) {
+        if (Poll() == 0)
+            Wait(timeout_ms);
+    }
+    Poll();
+}
+
+}
@@ -0,0 +1,239 @@
+/*
+   Copyright 2018 by Scott Early
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define SELIB_SAMPLES_X86
+#endif
+
+#include <seLib/experimental/SampleCodec.h>
+
+namespace seLib {
+namespace Serializable {
+
+using namespace std;
+
+static const uint8_t SampleFrameVersion = 1;
+
+static inline void StoreLE32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint32_t LoadLE32(const uint8_t* in) {
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// Samples widen to 32 bits with their sign, so deltas of 16-bit samples are
+// exact; 32-bit deltas wrap, which the decoder's sums undo.
+template <typename T>
+static inline uint32_t Widen(T value) {
+    return (uint32_t)(int32_t)value;
+}
+
+template <>
+inline uint32_t Widen(uint16_t value) {
+    return value;
+}
+
+// Byte counts and shuffles of the 256 control bytes.
+struct SampleShuffleTable {
+    uint8_t Length[256];
+    alignas(16) uint8_t Shuffle[256][16];
+
+    SampleShuffleTable() {
+        for (int control = 0; control < 256; control++) {
+            int position = 0;
+            for (int lane = 0; lane < 4; lane++) {
+                int bytes = ((control >> (2 * lane)) & 3) + 1;
+                for (int b = 0; b < 4; b++)
+                    Shuffle[control][lane * 4 + b] = (b < bytes) ? (uint8_t)(position + b) : 0x80;
+                position += bytes;
+            }
+            Length[control] = (uint8_t)position;
+        }
+    }
+};
+
+static const SampleShuffleTable ShuffleTable;
+
+//== Encode ========================================================================
+
+template <typename T>
+size_t EncodeSamples(const T* in, size_t count, uint8_t* out) {
+    if (count > UINT32_MAX)
+        throw exception();
+
+    SampleFrameHeader* header = (SampleFrameHeader*)out;
+    uint8_t* control = out + sizeof(SampleFrameHeader);
+    uint8_t* data = control + (count + 3) / 4;
+    uint8_t* start = data;
+    memset(control, 0, (count + 3) / 4);
+
+    uint32_t previous = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value = Widen(in[i]);
+        uint32_t delta = value - previous;
+        previous = value;
+        uint32_t zigzag = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+        int bytes = (zigzag < (1u << 8)) ? 1 : (zigzag < (1u << 16)) ? 2 : (zigzag < (1u << 24)) ? 3 : 4;
+        control[i / 4] |= (uint8_t)((bytes - 1) << (2 * (i % 4)));
+        // Little endian on the wire whatever the host.
+        uint8_t little[4];
+        StoreLE32(little, zigzag);
+        memcpy(data, little, bytes);
+        data += bytes;
+    }
+
+    header->Magic[0] = 'S';
+    header->Magic[1] = 'Z';
+    header->Version = SampleFrameVersion;
+    header->SampleType = SampleTypeOf<T>::Value;
+    StoreLE32(header->Count, (uint32_t)count);
+    StoreLE32(header->DataBytes, (uint32_t)(data - start));
+    return data - out;
+}
+
+//== Decode ========================================================================
+
+template <typename T>
+size_t SampleFrameCount(const uint8_t* in, size_t len) {
+    const SampleFrameHeader* header = (const SampleFrameHeader*)in;
+    if (len < sizeof(SampleFrameHeader) || header->Magic[0] != 'S' || header->Magic[1] != 'Z' ||
+        header->Version != SampleFrameVersion || header->SampleType != SampleTypeOf<T>::Value)
+        throw exception();
+    // Every sample takes a quarter control byte and at least one data byte,
+    // so a count the frame cannot hold is rejected before anyone sizes an
+    // output buffer from it.
+    size_t count = LoadLE32(header->Count);
+    if ((count + 3) / 4 + count > len - sizeof(SampleFrameHeader))
+        throw exception();
+    return count;
+}
+
+template <typename T>
+static inline void StoreSamples(T* out, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    out[0] = (T)a;
+    out[1] = (T)b;
+    out[2] = (T)c;
+    out[3] = (T)d;
+}
+
+#if defined(SELIB_SAMPLES_X86)
+
+// Four samples per control byte, while a whole 16-byte load stays inside the
+// data. Returns the number of samples decoded and leaves data and previous
+// where the scalar loop picks up.
+template <typename T>
+__attribute__((target("ssse3")))
+static size_t DecodeGroupsSsse3(const uint8_t* control, const uint8_t*& data, const uint8_t* dataEnd, size_t count, T* out, uint32_t& previous) {
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i carry = zero;
+    size_t i = 0;
+    for (; i + 4 <= count && data + 16 <= dataEnd; i += 4) {
+        uint8_t c = control[i / 4];
+        __m128i values = _mm_loadu_si128((const __m128i*)data);
+        values = _mm_shuffle_epi8(values, _mm_load_si128((const __m128i*)ShuffleTable.Shuffle[c]));
+        data += ShuffleTable.Length[c];
+        __m128i deltas = _mm_xor_si128(_mm_srli_epi32(values, 1), _mm_sub_epi32(zero, _mm_and_si128(values, one)));
+        deltas = _mm_add_epi32(deltas, _mm_slli_si128(deltas, 4));
+        deltas = _mm_add_epi32(deltas, _mm_slli_si128(deltas, 8));
+        __m128i samples = _mm_add_epi32(deltas, carry);
+        carry = _mm_shuffle_epi32(samples, 0xFF);
+        if (sizeof(T) == 4) {
+            _mm_storeu_si128((__m128i*)(out + i), samples);
+        } else {
+            // Keep the low half of each sample.
+            __m128i narrow = _mm_shuffle_epi8(samples, _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1));
+            _mm_storel_epi64((__m128i*)(out + i), narrow);
+        }
+    }
+    previous = (uint32_t)_mm_cvtsi128_si32(carry);
+    return i;
+}
+
+static const bool samples_ssse3 = __builtin_cpu_supports("ssse3");
+
+#endif
+
+template <typename T>
+size_t DecodeSamples(const uint8_t* in, size_t len, T* out) {
+    size_t count = SampleFrameCount<T>(in, len);
+    const SampleFrameHeader* header = (const SampleFrameHeader*)in;
+    size_t controlBytes = (count + 3) / 4;
+    size_t dataBytes = LoadLE32(header->DataBytes);
+    if (len - sizeof(SampleFrameHeader) < controlBytes || len - sizeof(SampleFrameHeader) - controlBytes < dataBytes)
+        throw exception();
+
+    const uint8_t* control = in + sizeof(SampleFrameHeader);
+    const uint8_t* data = control + controlBytes;
+
+    // The control bytes must account for exactly the data bytes, so the
+    // decoder below never reads past them. Unused lanes of the last control
+    // byte count one byte each and are subtracted.
+    size_t total = 0;
+    for (size_t g = 0; g < controlBytes; g++)
+        total += ShuffleTable.Length[control[g]];
+    if (count % 4 != 0) {
+        uint8_t last = control[controlBytes - 1];
+        for (size_t lane = count % 4; lane < 4; lane++)
+            total -= ((last >> (2 * lane)) & 3) + 1;
+    }
+    if (total != dataBytes)
+        throw exception();
+
+    size_t i = 0;
+    uint32_t previous = 0;
+
+#if defined(SELIB_SAMPLES_X86)
+    if (samples_ssse3)
+        i = DecodeGroupsSsse3(control, data, data + dataBytes, count, out, previous);
+#endif
+
+    for (; i < count; i++) {
+        uint8_t c = control[i / 4];
+        int bytes = ((c >> (2 * (i % 4))) & 3) + 1;
+        uint32_t zigzag = 0;
+        for (int b = 0; b < bytes; b++)
+            zigzag |= (uint32_t)data[b] << (8 * b);
+        data += bytes;
+        uint32_t delta = (zigzag >> 1) ^ (0u - (zigzag & 1));
+        previous += delta;
+        out[i] = (T)previous;
+    }
+    return count;
+}
+
+template size_t EncodeSamples<int16_t>(const int16_t*, size_t, uint8_t*);
+template size_t EncodeSamples<uint16_t>(const uint16_t*, size_t, uint8_t*);
+template size_t EncodeSamples<int32_t>(const int32_t*, size_t, uint8_t*);
+template size_t EncodeSamples<uint32_t>(const uint32_t*, size_t, uint8_t*);
+template size_t SampleFrameCount<int16_t>(const uint8_t*, size_t);
+template size_t SampleFrameCount<uint16_t>(const uint8_t*, size_t);
+template size_t SampleFrameCount<int32_t>(const uint8_t*, size_t);
+template size_t SampleFrameCount<uint32_t>(const uint8_t*, size_t);
+template size_t DecodeSamples<int16_t>(const uint8_t*, size_t, int16_t*);
+template size_t DecodeSamples<uint16_t>(const uint8_t*, size_t, uint16_t*);
+template size_t DecodeSamples<int32_t>(const uint8_t*, size_t, int32_t*);
+template size_t DecodeSamples<uint32_t>(const uint8_t*, size_t, uint32_t*);
+
+}
+}